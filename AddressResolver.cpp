@@ -1,4 +1,5 @@
 #include "AddressResolver.h"
+#include "DebuginfodClient.h"
 
 #include <algorithm>
 #include <map>
@@ -40,13 +41,16 @@ public:
   Elf* get() { return elf_; }
   Elf_Scn* getSection(Section section) { return sections_[section]; }
   uint64_t getBaseAddress() const { return baseAddress_; }
+  const std::string& getBuildId() const { return buildId_; }
 private:
   ElfHolder(const ElfHolder&);
   ElfHolder& operator=(const ElfHolder&);
 
   void loadInfo();
+  void loadBuildId(Elf_Scn* section);
 
   uint64_t baseAddress_;
+  std::string buildId_;
   Elf* elf_;
   Elf_Scn* sections_[SectionCount];
   int fd_;
@@ -74,6 +78,7 @@ void ElfHolder::open(const char *fileName)
     ::close(fd_);
 
   baseAddress_ = 0;
+  buildId_.clear();
   memset(sections_, 0, sizeof(sections_));
 
   fd_ = ::open(fileName, O_RDONLY);
@@ -88,6 +93,7 @@ void ElfHolder::close()
   elf_ = 0;
   fd_ = -1;
   baseAddress_ = 0;
+  buildId_.clear();
   memset(sections_, 0, sizeof(sections_));
 }
 
@@ -134,6 +140,10 @@ void ElfHolder::loadInfo()
       sections_[DynSym] = scn;
       needToFind--;
       break;
+    case SHT_NOTE:
+      if (buildId_.empty())
+        loadBuildId(scn);
+      break;
     case SHT_PROGBITS:
       sectionName = elf_strptr(elf_, ehdr.e_shstrndx, shdr.sh_name);
       if (strcmp(sectionName, ".debug_info") == 0)
@@ -177,6 +187,56 @@ void ElfHolder::loadInfo()
   }
 }
 
+void ElfHolder::loadBuildId(Elf_Scn* section)
+{
+  static const char hexDigits[] = "0123456789abcdef";
+  Elf_Data* data = elf_getdata(section, 0);
+  if (!data)
+    return;
+
+  GElf_Nhdr note;
+  size_t nameOffset, descOffset;
+  size_t offset = 0;
+  while ((offset = gelf_getnote(data, offset, &note, &nameOffset, &descOffset)) > 0)
+  {
+    if (note.n_type != NT_GNU_BUILD_ID || note.n_namesz != sizeof(ELF_NOTE_GNU) ||
+        memcmp((char*)data->d_buf + nameOffset, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU)) != 0)
+      continue;
+
+    const unsigned char* desc = (const unsigned char*)data->d_buf + descOffset;
+    for (size_t i = 0; i < note.n_descsz; ++i)
+      buildId_.append(1, hexDigits[desc[i] >> 4]).append(1, hexDigits[desc[i] & 0xf]);
+    break;
+  }
+}
+
+static DebuginfodClient& debuginfod()
+{
+  static DebuginfodClient client;
+  return client;
+}
+
+static std::string localDebugFileName(const char* fileName)
+{
+  std::string debugFileName = "/usr/lib/debug";
+  debugFileName.append(fileName);
+  debugFileName.append(".debug");
+  return debugFileName;
+}
+
+static bool hasLocalDebugFile(ElfHolder& elfh, const char* fileName)
+{
+  return elfh.getSection(DebugLink) && access(localDebugFileName(fileName).c_str(), R_OK) == 0;
+}
+
+/// File lacks something we have to show in requested details level
+static bool needsDebugInfo(ElfHolder& elfh, Profile::DetailLevel details)
+{
+  if (details == Profile::Objects)
+    return false;
+  return !elfh.getSection(SymTab) || (details == Profile::Sources && !elfh.getSection(DebugInfo));
+}
+
 struct ARSymbolData
 {
   enum { MiscPLT = 255 };
@@ -186,8 +246,12 @@ struct ARSymbolData
   {}
   explicit ARSymbolData(uint64_t _size)
     : size(_size)
+    , misc(0)
+  {}
+  ARSymbolData()
+    : size(0)
+    , misc(0)
   {}
-  ARSymbolData() {}
   uint64_t size;
   std::string name;
   unsigned char misc;
@@ -264,14 +328,21 @@ AddressResolver::AddressResolver(Profile::DetailLevel details, const char *fileN
     d->setOriginalBaseAddress(elfh.get(), elfh.getSection(PrelinkUndo));
 
   std::string debugModuleName = fileName;
-  if (details != Profile::Objects && elfh.getSection(DebugLink))
-  {
-    // Get name
-    debugModuleName = "/usr/lib/debug";
-    debugModuleName.append(fileName);
-    debugModuleName.append(".debug");
+  if (hasLocalDebugFile(elfh, fileName))
     /// @todo Use debug link
+    debugModuleName = localDebugFileName(fileName);
+  else if (needsDebugInfo(elfh, details))
+  {
+    // Ask debuginfod servers, this is cheap if file was prefetched already
+    const std::string& fetchedName = debuginfod().findDebugInfo(elfh.getBuildId());
+    if (!fetchedName.empty())
+      debugModuleName = fetchedName;
+    else if (elfh.getSection(DebugLink))
+      debugModuleName = localDebugFileName(fileName);
+  }
 
+  if (details != Profile::Objects && debugModuleName != fileName)
+  {
     if (!symTabLoaded)
     {
       elfh.close();
@@ -294,6 +365,39 @@ AddressResolver::AddressResolver(Profile::DetailLevel details, const char *fileN
   }
 }
 
+AddressResolver::AddressResolver(Profile::DetailLevel details, const char* objectName, uint64_t objectSize,
+                                 const std::map<Range, std::string>& symbols)
+  : d(new AddressResolverPrivate)
+{
+  if (details != Profile::Objects)
+    for (std::map<Range, std::string>::const_iterator symIt = symbols.begin(); symIt != symbols.end(); ++symIt)
+    {
+      ARSymbolData symbolData(symIt->first.end - symIt->first.start);
+      symbolData.name = symIt->second;
+      symbolData.misc = STB_GLOBAL;
+      d->symbols.insert(ARSymbol(symIt->first, symbolData));
+    }
+
+  d->constructFakeSymbols(details, objectSize, objectName);
+}
+
+void AddressResolver::prefetchDebugInfo(Profile::DetailLevel details, const std::vector<std::string>& fileNames)
+{
+  if (details == Profile::Objects || !debuginfod().enabled())
+    return;
+
+  elf_version(EV_CURRENT);
+  std::vector<std::string> buildIds;
+  for (std::vector<std::string>::const_iterator it = fileNames.begin(); it != fileNames.end(); ++it)
+  {
+    ElfHolder elfh(it->c_str());
+    if (!elfh.getBuildId().empty() && !hasLocalDebugFile(elfh, it->c_str()) && needsDebugInfo(elfh, details))
+      buildIds.push_back(elfh.getBuildId());
+  }
+
+  debuginfod().prefetch(buildIds);
+}
+
 AddressResolver::~AddressResolver()
 {
   if (d->dwfl)
@@ -314,7 +418,8 @@ static std::string constructSymbolName(uint64_t address)
   return ss.str();
 }
 
-bool AddressResolver::resolve(Address value, Address loadBase, Range& symbolRange, std::string& symbolName) const
+bool AddressResolver::resolve(Address value, Address loadBase, Range& symbolRange, std::string& symbolName,
+                              std::string* linkageName, bool* plt) const
 {
   uint64_t adjust = loadBase - d->baseAddress;
   ARSymbolStorage::const_iterator arSymIt = d->symbols.find(Range(value - adjust));
@@ -330,6 +435,8 @@ bool AddressResolver::resolve(Address value, Address loadBase, Range& symbolRang
 
   symbolRange.start = arSymIt->first.start + adjust;
   symbolRange.end = arSymIt->first.end + adjust;
+  if (plt)
+    *plt = arSymIt->second.misc == ARSymbolData::MiscPLT;
 
   const std::string& maybeSymbolName = arSymIt->second.name;
   if (maybeSymbolName.empty())
@@ -341,6 +448,8 @@ bool AddressResolver::resolve(Address value, Address loadBase, Range& symbolRang
     {
       symbolName = demangledName;
       free(demangledName);
+      if (linkageName)
+        *linkageName = maybeSymbolName;
     }
     else
       symbolName = maybeSymbolName;
@@ -407,6 +516,7 @@ void AddressResolverPrivate::loadPLTSymbols(Elf* elf, Elf_Scn *pltSection, Elf_S
 
 
     ARSymbolData& symbolData = symbols[Range(symStart, symStart + symSize)];
+    symbolData.size = symSize;
     symbolData.name = elf_strptr(elf, strtabIdx, elfSymbol.st_name);
     symbolData.misc = ARSymbolData::MiscPLT;
 
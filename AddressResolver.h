@@ -4,6 +4,7 @@
 #include "Profile.h"
 
 #include <utility>
+#include <vector>
 #include <stdint.h>
 
 class AddressResolverPrivate;
@@ -12,10 +13,19 @@ class AddressResolver
 {
 public:
   AddressResolver(Profile::DetailLevel details, const char* fileName, uint64_t objectSize);
+  /// Resolver for code without file, symbol ranges are relative to object start
+  AddressResolver(Profile::DetailLevel details, const char* objectName, uint64_t objectSize,
+                  const std::map<Range, std::string>& symbols);
   ~AddressResolver();
 
+  /// Fetch missing debug files for all objects from debuginfod servers at once
+  static void prefetchDebugInfo(Profile::DetailLevel details, const std::vector<std::string>& fileNames);
+
   Address baseAddress() const;
-  bool resolve(Address value, Address loadBase, Range& symbolRange, std::string& symbolName) const;
+  /// Symbol name is demangled, original name is put into linkageName if it differs
+  /** PLT entries get "@plt" suffix and plt is set for them. */
+  bool resolve(Address value, Address loadBase, Range& symbolRange, std::string& symbolName,
+               std::string* linkageName = 0, bool* plt = 0) const;
   std::pair<const char*, size_t> getSourcePosition(Address value, Address loadBase) const;
 
 private:
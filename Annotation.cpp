@@ -0,0 +1,187 @@
+#include "Annotation.h"
+#include "CallGraph.h"
+#include "OutputBuffer.h"
+
+#include <algorithm>
+#include <fstream>
+
+/// Lines shown before and after every hot line
+static const size_t contextLines = 3;
+/// Percents of target cost, which make line hot and warm
+static const double hotPercent = 5.0;
+static const double warmPercent = 0.5;
+
+static const char hotColor[] = "\033[31m";
+static const char warmColor[] = "\033[32m";
+static const char resetColor[] = "\033[0m";
+
+const SourceCache::Lines* SourceCache::lines(const std::string& fileName)
+{
+  if (missing_.count(fileName))
+    return 0;
+  std::tr1::unordered_map<std::string, Lines>::const_iterator fileIt = files_.find(fileName);
+  if (fileIt != files_.end())
+    return &fileIt->second;
+
+  std::ifstream file(fileName.c_str());
+  if (!file)
+  {
+    missing_[fileName] = true;
+    return 0;
+  }
+  Lines& lines = files_[fileName];
+  std::string line;
+  while (std::getline(file, line))
+    lines.push_back(line);
+  return &lines;
+}
+
+/// Zero costs are left blank, so cold lines are easy to skip
+static void writePercent(OutputBuffer& os, Count value, Count total)
+{
+  if (value)
+    os << Percent(value, total, 9);
+  else
+    os << Padding(9, 0);
+}
+
+Annotation::Annotation(const Profile& profile, const std::string& target)
+  : target_(target)
+  , unknown_(0)
+  , total_(0)
+{
+  // Calls from line cost no more than inclusive cost of callee, as in call graph
+  CallGraph graph(profile);
+  std::tr1::unordered_map<const Symbol*, Count> calleeCosts;
+  const CallGraph::NodeStorage& nodes = graph.nodes();
+  for (CallGraph::NodeStorage::const_iterator nodeIt = nodes.begin(); nodeIt != nodes.end(); ++nodeIt)
+    calleeCosts[nodeIt->symbol] = nodeIt->inclusive;
+
+  std::tr1::unordered_map<const std::string*, bool> fileMatches;
+  const MemoryObjectStorage& objects = profile.memoryObjects();
+  for (MemoryObjectStorage::const_iterator objIt = objects.begin(); objIt != objects.end(); ++objIt)
+  {
+    const SymbolStorage& symbols = objIt->second->symbols();
+    const EntryStorage& entries = objIt->second->entries();
+    SymbolStorage::const_iterator symIt = symbols.end();
+    bool symbolMatches = false;
+    for (EntryStorage::const_iterator entryIt = entries.begin(); entryIt != entries.end(); ++entryIt)
+    {
+      if (symIt == symbols.end() || entryIt->first >= symIt->first.end)
+      {
+        symIt = symbols.find(Range(entryIt->first));
+        symbolMatches = symIt != symbols.end() && matchesSymbol(symIt->second->name());
+      }
+
+      const EntryData& entry = *entryIt->second;
+      if (!symbolMatches)
+      {
+        std::pair<std::tr1::unordered_map<const std::string*, bool>::iterator, bool> insResult =
+            fileMatches.insert(std::make_pair(&entry.sourceFile(), false));
+        if (insResult.second)
+          insResult.first->second = entry.sourceLine() != 0 && matchesFile(entry.sourceFile());
+        if (!insResult.first->second)
+          continue;
+      }
+
+      Count calls = 0;
+      const BranchStorage& branches = entry.branches();
+      for (BranchStorage::const_iterator branchIt = branches.begin(); branchIt != branches.end(); ++branchIt)
+        calls += std::min(branchIt->second.main(), calleeCosts[branchIt->first.symbol]);
+      total_ += entry.count() + calls;
+
+      if (entry.sourceLine() == 0)
+      {
+        unknown_ += entry.count() + calls;
+        continue;
+      }
+      LineCost& cost = files_[entry.sourceFile()][entry.sourceLine()];
+      cost.self += entry.count();
+      cost.calls += calls;
+    }
+  }
+}
+
+bool Annotation::matchesSymbol(const std::string& name) const
+{
+  // C++ names are matched without argument list too
+  return name.compare(0, target_.size(), target_) == 0 &&
+      (name.size() == target_.size() || name[target_.size()] == '(');
+}
+
+bool Annotation::matchesFile(const std::string& fileName) const
+{
+  if (fileName.size() < target_.size() || fileName.compare(fileName.size() - target_.size(), target_.size(), target_))
+    return false;
+  return fileName.size() == target_.size() || fileName[fileName.size() - target_.size() - 1] == '/';
+}
+
+void Annotation::writeFile(OutputBuffer& os, const std::string& fileName, const LineCosts& costs, bool colors)
+{
+  Count fileSelf = 0;
+  Count fileCalls = 0;
+  for (LineCosts::const_iterator costIt = costs.begin(); costIt != costs.end(); ++costIt)
+  {
+    fileSelf += costIt->second.self;
+    fileCalls += costIt->second.calls;
+  }
+  os << "\nFile " << fileName << ", self " << fileSelf << ", calls " << fileCalls << '\n'
+     << "    Self%    Calls%    Line\n";
+
+  const SourceCache::Lines* lines = sources_.lines(fileName);
+  if (!lines)
+    os << "  (source is not available)\n";
+
+  // Hot lines are sorted, so ranges around them are merged on the way
+  std::vector<std::pair<size_t, size_t> > ranges;
+  size_t context = lines ? contextLines : 0;
+  for (LineCosts::const_iterator costIt = costs.begin(); costIt != costs.end(); ++costIt)
+  {
+    size_t first = std::max(costIt->first, context + 1) - context;
+    size_t last = costIt->first + context;
+    if (lines)
+      last = std::min(last, std::max(lines->size(), costIt->first));
+    if (!ranges.empty() && first <= ranges.back().second + 1)
+      ranges.back().second = last;
+    else
+      ranges.push_back(std::make_pair(first, last));
+  }
+
+  for (size_t i = 0; i < ranges.size(); ++i)
+  {
+    if (ranges[i].first > (i ? ranges[i - 1].second + 1 : 1))
+      os << "  ...\n";
+    for (size_t line = ranges[i].first; line <= ranges[i].second; ++line)
+    {
+      LineCost cost;
+      LineCosts::const_iterator costIt = costs.find(line);
+      if (costIt != costs.end())
+        cost = costIt->second;
+      double percent = 100.0 * (cost.self + cost.calls) / total_;
+      const char* color = !colors ? 0 : percent >= hotPercent ? hotColor : percent >= warmPercent ? warmColor : 0;
+      if (color)
+        os << color;
+      writePercent(os, cost.self, total_);
+      os << ' ';
+      writePercent(os, cost.calls, total_);
+      os << ' ';
+      os << Padded(line, 7) << "  ";
+      if (lines && line <= lines->size())
+        os << (*lines)[line - 1];
+      if (color)
+        os << resetColor;
+      os << '\n';
+    }
+  }
+  if (lines && !ranges.empty() && ranges.back().second < lines->size())
+    os << "  ...\n";
+}
+
+void Annotation::write(OutputBuffer& os, bool colors)
+{
+  os << "Annotation of '" << target_ << "', " << total_ << " samples including calls\n";
+  for (std::map<std::string, LineCosts>::const_iterator fileIt = files_.begin(); fileIt != files_.end(); ++fileIt)
+    writeFile(os, fileIt->first, fileIt->second, colors);
+  if (unknown_)
+    os << "\nUnknown source position: " << unknown_ << " samples\n";
+}
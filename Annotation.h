@@ -0,0 +1,64 @@
+#ifndef ANNOTATION_H
+#define ANNOTATION_H
+
+#include "Profile.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+class OutputBuffer;
+
+/// Reads source files line by line, every file is read only once
+class SourceCache
+{
+public:
+  typedef std::vector<std::string> Lines;
+
+  /// Returns 0 if file could not be read
+  const Lines* lines(const std::string& fileName);
+
+private:
+  std::tr1::unordered_map<std::string, Lines> files_;
+  std::tr1::unordered_map<std::string, bool> missing_;
+};
+
+/// Source listing of symbol or source file with costs of every line
+/** Profile should be resolved with \ref Profile::Sources details. Target matches symbols with the same name or with
+ *  the same name before argument list, and source files with the same path or path suffix. Only hot lines with few
+ *  lines around them are listed. */
+class Annotation
+{
+public:
+  Annotation(const Profile& profile, const std::string& target);
+
+  /// True if target has no samples
+  bool empty() const { return total_ == 0; }
+
+  /// Colors mark hot lines with terminal escape sequences
+  void write(OutputBuffer& os, bool colors);
+
+private:
+  struct LineCost
+  {
+    LineCost() : self(0), calls(0) {}
+    Count self;
+    /// Calls made from line
+    Count calls;
+  };
+  typedef std::map<size_t, LineCost> LineCosts;
+
+  bool matchesSymbol(const std::string& name) const;
+  bool matchesFile(const std::string& fileName) const;
+  void writeFile(OutputBuffer& os, const std::string& fileName, const LineCosts& costs, bool colors);
+
+  std::string target_;
+  std::map<std::string, LineCosts> files_;
+  /// Samples without known source position
+  Count unknown_;
+  Count total_;
+  SourceCache sources_;
+};
+
+#endif // ANNOTATION_H
@@ -0,0 +1,32 @@
+#include "BoltWriter.h"
+#include "OutputBuffer.h"
+
+void BoltWriter::write()
+{
+  os_ << "no_lbr\n";
+
+  const MemoryObjectStorage& objects = profile_.memoryObjects();
+  for (MemoryObjectStorage::const_iterator objIt = objects.begin(); objIt != objects.end(); ++objIt)
+  {
+    // Objects without file have names in brackets
+    if (objIt->second->fileName().empty() || objIt->second->fileName()[0] == '[')
+      continue;
+
+    const SymbolStorage& symbols = objIt->second->symbols();
+    const EntryStorage& entries = objIt->second->entries();
+    SymbolStorage::const_iterator symIt = symbols.end();
+    for (EntryStorage::const_iterator entryIt = entries.begin(); entryIt != entries.end(); ++entryIt)
+    {
+      // Call graph entries of call sites could have no samples of their own
+      if (entryIt->second->count() == 0)
+        continue;
+      if (symIt == symbols.end() || entryIt->first >= symIt->first.end)
+        symIt = symbols.find(Range(entryIt->first));
+      if (symIt == symbols.end() || symIt->second->isPlt())
+        continue;
+
+      os_ << "1 " << symIt->second->linkageName() << ' ' << Hex(entryIt->first - symIt->first.start) << ' '
+          << entryIt->second->count() << '\n';
+    }
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef BOLTWRITER_H
+#define BOLTWRITER_H
+
+#include "Profile.h"
+
+class OutputBuffer;
+
+/// Writes samples in BOLT fdata format without LBR, as 'perf2bolt -nl' does
+/** Every entry becomes "1 symbol offset count" record, where symbol is linkage name and offset is hexadecimal
+ *  offset of entry from symbol start. Symbols of objects without files (JIT code, vDSO) and PLT entries are not
+ *  known to BOLT and are skipped. */
+class BoltWriter
+{
+public:
+  BoltWriter(OutputBuffer& os, const Profile& profile) : os_(os), profile_(profile) {}
+
+  void write();
+
+private:
+  OutputBuffer& os_;
+  const Profile& profile_;
+};
+
+#endif // BOLTWRITER_H
@@ -0,0 +1,164 @@
+#include "CallGraph.h"
+
+#include <algorithm>
+#include <tr1/unordered_map>
+
+static const size_t noIndex = size_t(-1);
+
+CallGraph::CallGraph(const Profile& profile, Level level)
+  : total_(0)
+{
+  const MemoryObjectStorage& objects = profile.memoryObjects();
+  std::tr1::unordered_map<const Symbol*, size_t> symbolNodes;
+
+  // Callees could be in other objects, so every symbol gets its node first
+  for (MemoryObjectStorage::const_iterator objIt = objects.begin(); objIt != objects.end(); ++objIt)
+  {
+    const SymbolStorage& symbols = objIt->second->symbols();
+    if (level == Objects)
+    {
+      Node node = { 0, objIt->second, 0, 0, 0 };
+      nodes_.push_back(node);
+    }
+    for (SymbolStorage::const_iterator symIt = symbols.begin(); symIt != symbols.end(); ++symIt)
+    {
+      if (level == Objects)
+      {
+        symbolNodes[&*symIt] = nodes_.size() - 1;
+        continue;
+      }
+      Node node = { &*symIt, objIt->second, 0, 0, 0 };
+      symbolNodes[&*symIt] = nodes_.size();
+      nodes_.push_back(node);
+    }
+  }
+
+  std::tr1::unordered_map<uint64_t, size_t> edgeIndexes;
+  size_t objectNode = 0;
+  for (MemoryObjectStorage::const_iterator objIt = objects.begin(); objIt != objects.end(); ++objIt, ++objectNode)
+  {
+    const SymbolStorage& symbols = objIt->second->symbols();
+    const EntryStorage& entries = objIt->second->entries();
+    SymbolStorage::const_iterator symIt = symbols.end();
+    for (EntryStorage::const_iterator entryIt = entries.begin(); entryIt != entries.end(); ++entryIt)
+    {
+      // Entries and symbols are both sorted, so lookup is needed only when entry leaves current symbol
+      if (symIt == symbols.end() || entryIt->first >= symIt->first.end)
+        symIt = symbols.find(Range(entryIt->first));
+      if (symIt == symbols.end())
+        continue;
+
+      size_t from = level == Objects ? objectNode : symbolNodes[&*symIt];
+      nodes_[from].self += entryIt->second->count();
+      total_ += entryIt->second->count();
+
+      const BranchStorage& branches = entryIt->second->branches();
+      for (BranchStorage::const_iterator branchIt = branches.begin(); branchIt != branches.end(); ++branchIt)
+      {
+        std::tr1::unordered_map<const Symbol*, size_t>::const_iterator toIt = symbolNodes.find(branchIt->first.symbol);
+        if (toIt == symbolNodes.end() || toIt->second == from)
+          continue;
+        std::pair<std::tr1::unordered_map<uint64_t, size_t>::iterator, bool> insResult =
+            edgeIndexes.insert(std::make_pair(uint64_t(from) << 32 | toIt->second, edges_.size()));
+        if (insResult.second)
+        {
+          Edge edge = { from, toIt->second, 0 };
+          edges_.push_back(edge);
+        }
+        edges_[insResult.first->second].count += branchIt->second.main();
+      }
+    }
+  }
+  std::sort(edges_.begin(), edges_.end());
+
+  computeInclusive();
+}
+
+void CallGraph::computeInclusive()
+{
+  size_t nodeCount = nodes_.size();
+  // Edges of node n are [edgeBegin[n], edgeBegin[n + 1])
+  std::vector<size_t> edgeBegin(nodeCount + 1, 0);
+  for (EdgeStorage::const_iterator edgeIt = edges_.begin(); edgeIt != edges_.end(); ++edgeIt)
+    edgeBegin[edgeIt->from + 1]++;
+  for (size_t i = 0; i < nodeCount; ++i)
+    edgeBegin[i + 1] += edgeBegin[i];
+
+  // Tarjan's algorithm without recursion, as call chains could be deeper than native stack allows
+  std::vector<size_t> order(nodeCount, noIndex);
+  std::vector<size_t> lowLink(nodeCount, 0);
+  std::vector<size_t> component(nodeCount, noIndex);
+  std::vector<size_t> stack;
+  std::vector<std::pair<size_t, size_t> > calls;
+  size_t counter = 0;
+  size_t componentCount = 0;
+  for (size_t root = 0; root < nodeCount; ++root)
+  {
+    if (order[root] != noIndex)
+      continue;
+    order[root] = lowLink[root] = counter++;
+    stack.push_back(root);
+    calls.push_back(std::make_pair(root, edgeBegin[root]));
+    while (!calls.empty())
+    {
+      size_t node = calls.back().first;
+      if (calls.back().second < edgeBegin[node + 1])
+      {
+        size_t to = edges_[calls.back().second++].to;
+        if (order[to] == noIndex)
+        {
+          order[to] = lowLink[to] = counter++;
+          stack.push_back(to);
+          calls.push_back(std::make_pair(to, edgeBegin[to]));
+        }
+        else if (component[to] == noIndex)
+          lowLink[node] = std::min(lowLink[node], order[to]);
+        continue;
+      }
+
+      calls.pop_back();
+      if (!calls.empty())
+        lowLink[calls.back().first] = std::min(lowLink[calls.back().first], lowLink[node]);
+      if (lowLink[node] == order[node])
+      {
+        size_t member;
+        do
+        {
+          member = stack.back();
+          stack.pop_back();
+          component[member] = componentCount;
+        } while (member != node);
+        ++componentCount;
+      }
+    }
+  }
+
+  // Cost of component is self cost of its members and calls leaving it
+  std::vector<Count> componentCost(componentCount, 0);
+  std::vector<size_t> componentSize(componentCount, 0);
+  std::vector<Count> calleesCost(nodeCount, 0);
+  for (size_t i = 0; i < nodeCount; ++i)
+  {
+    componentCost[component[i]] += nodes_[i].self;
+    componentSize[component[i]]++;
+  }
+  for (EdgeStorage::const_iterator edgeIt = edges_.begin(); edgeIt != edges_.end(); ++edgeIt)
+  {
+    calleesCost[edgeIt->from] += edgeIt->count;
+    if (component[edgeIt->from] != component[edgeIt->to])
+      componentCost[component[edgeIt->from]] += edgeIt->count;
+  }
+
+  for (size_t i = 0; i < nodeCount; ++i)
+  {
+    nodes_[i].cycle = component[i];
+    Count inclusive = nodes_[i].self + calleesCost[i];
+    if (componentSize[component[i]] > 1)
+      inclusive = std::min(inclusive, componentCost[component[i]]);
+    nodes_[i].inclusive = std::min(inclusive, total_);
+  }
+
+  // Recursive calls are counted once per level too, but no more samples could go through call than callee has
+  for (EdgeStorage::iterator edgeIt = edges_.begin(); edgeIt != edges_.end(); ++edgeIt)
+    edgeIt->count = std::min(edgeIt->count, nodes_[edgeIt->to].inclusive);
+}
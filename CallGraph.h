@@ -0,0 +1,59 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include "Profile.h"
+
+#include <vector>
+
+/// Symbols or objects of profile with their self and inclusive costs and calls between them
+/** Calls are taken from \ref BranchStorage. Branch counts of recursive calls include the same samples once per
+ *  level, unless profile is loaded with \ref Profile::setDedupCallSites(), so inclusive costs are computed over
+ *  strongly connected components of graph: within recursion cost is bounded by cost of whole cycle, and no call costs
+ *  more than its callee. */
+class CallGraph
+{
+public:
+  enum Level { Symbols, Objects };
+
+  struct Node
+  {
+    /// 0 for object nodes
+    const Symbol* symbol;
+    const MemoryObjectData* object;
+    Count self;
+    Count inclusive;
+    /// Nodes calling each other recursively have the same cycle, which is index of strongly connected component
+    size_t cycle;
+  };
+  typedef std::vector<Node> NodeStorage;
+
+  struct Edge
+  {
+    size_t from;
+    size_t to;
+    Count count;
+    bool operator<(const Edge& other) const
+    {
+      return from < other.from || (from == other.from && to < other.to);
+    }
+  };
+  typedef std::vector<Edge> EdgeStorage;
+
+  explicit CallGraph(const Profile& profile, Level level = Symbols);
+
+  /// Symbols are in order of objects and their addresses
+  const NodeStorage& nodes() const { return nodes_; }
+  /// Sorted by caller and callee, calls within one node are dropped
+  const EdgeStorage& edges() const { return edges_; }
+  /// Self costs of all nodes
+  Count total() const { return total_; }
+
+private:
+  void computeInclusive();
+
+  NodeStorage nodes_;
+  EdgeStorage edges_;
+  Count total_;
+};
+
+#endif // CALLGRAPH_H
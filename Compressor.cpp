@@ -0,0 +1,164 @@
+#include "Compressor.h"
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static const size_t chunkSize = 1024 * 1024;
+
+class CompressorPrivate
+{
+  friend class Compressor;
+  explicit CompressorPrivate(int outputFd);
+
+  bool compress();
+
+  static void* worker(void* arg);
+
+  int outputFd_;
+  int pipe_[2];
+  pthread_t thread_;
+  bool started_;
+  bool ok_;
+  /// errno of the first error
+  int error_;
+};
+
+static bool writeAll(int fd, const unsigned char* data, size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t written = write(fd, data, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+CompressorPrivate::CompressorPrivate(int outputFd)
+  : outputFd_(outputFd)
+  , started_(false)
+  , ok_(false)
+  , error_(0)
+{
+  pipe_[0] = pipe_[1] = -1;
+}
+
+bool CompressorPrivate::compress()
+{
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  // 16 is added to window bits to get gzip header and trailer instead of zlib ones
+  bool initialized = (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                                   Z_DEFAULT_STRATEGY) == Z_OK);
+
+  unsigned char* input = new unsigned char[chunkSize];
+  unsigned char* output = new unsigned char[chunkSize];
+  bool ok = initialized;
+  bool writeFailed = !initialized;
+  int flush = Z_NO_FLUSH;
+
+  while (flush != Z_FINISH)
+  {
+    ssize_t size = read(pipe_[0], input, chunkSize);
+    if (size < 0 && errno == EINTR)
+      continue;
+    if (size < 0 && ok)
+    {
+      error_ = errno;
+      ok = false;
+    }
+    if (size <= 0)
+      flush = Z_FINISH;
+
+    // Keep reading after errors, otherwise rendering thread would block on full pipe
+    if (writeFailed)
+      continue;
+
+    stream.next_in = input;
+    stream.avail_in = size > 0 ? size : 0;
+    do
+    {
+      stream.next_out = output;
+      stream.avail_out = chunkSize;
+      deflate(&stream, flush);
+      if (!writeAll(outputFd_, output, chunkSize - stream.avail_out))
+      {
+        error_ = errno;
+        writeFailed = true;
+        ok = false;
+        break;
+      }
+    }
+    while (stream.avail_out == 0);
+  }
+
+  if (initialized)
+    deflateEnd(&stream);
+  delete[] input;
+  delete[] output;
+  return ok;
+}
+
+void* CompressorPrivate::worker(void* arg)
+{
+  CompressorPrivate* d = static_cast<CompressorPrivate*>(arg);
+  d->ok_ = d->compress();
+  close(d->pipe_[0]);
+  d->pipe_[0] = -1;
+  return 0;
+}
+
+// Compressor methods
+
+Compressor::Compressor(int outputFd)
+  : d(new CompressorPrivate(outputFd))
+{}
+
+Compressor::~Compressor()
+{
+  finish();
+  delete d;
+}
+
+int Compressor::start()
+{
+  if (pipe(d->pipe_) != 0)
+    return -1;
+  // Bigger pipe lets rendering go further ahead of compression
+  fcntl(d->pipe_[1], F_SETPIPE_SZ, chunkSize);
+
+  if (pthread_create(&d->thread_, 0, &CompressorPrivate::worker, d) != 0)
+  {
+    close(d->pipe_[0]);
+    close(d->pipe_[1]);
+    d->pipe_[0] = d->pipe_[1] = -1;
+    return -1;
+  }
+
+  d->started_ = true;
+  return d->pipe_[1];
+}
+
+bool Compressor::finish()
+{
+  if (!d->started_)
+    return d->ok_;
+
+  close(d->pipe_[1]);
+  d->pipe_[1] = -1;
+  pthread_join(d->thread_, 0);
+  d->started_ = false;
+  if (!d->ok_)
+    errno = d->error_;
+  return d->ok_;
+}
@@ -0,0 +1,28 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+class CompressorPrivate;
+
+/// Gzip compression of output on separate thread
+/** Uncompressed text is written to pipe returned by \ref start(), compression thread reads it from there and writes
+ *  gzip stream to output descriptor. So rendering and compression run in parallel, and the pipe limits amount of
+ *  uncompressed data waiting for compression. */
+class Compressor
+{
+public:
+  explicit Compressor(int outputFd);
+  ~Compressor();
+
+  /// Starts compression thread, returns descriptor for uncompressed data or -1 on error
+  int start();
+  /// Closes descriptor for uncompressed data and waits for compression to finish, returns false on errors
+  bool finish();
+
+private:
+  Compressor(const Compressor&);
+  Compressor& operator=(const Compressor&);
+
+  CompressorPrivate* d;
+};
+
+#endif // COMPRESSOR_H
@@ -0,0 +1,448 @@
+#include "DebuginfodClient.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <cerrno>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static const unsigned maxParallelRequests = 8;
+static const unsigned defaultTimeout = 90;
+
+struct DebuginfodServer
+{
+  enum Kind { LocalDirectory, Http };
+  Kind kind;
+  std::string host;
+  std::string port;
+  /// Directory for local servers, URL path prefix for remote ones
+  std::string path;
+};
+
+class DebuginfodClientPrivate
+{
+  friend class DebuginfodClient;
+  DebuginfodClientPrivate();
+  ~DebuginfodClientPrivate();
+
+  void parseServers(const char* urls);
+  std::string find(const std::string& buildId);
+  std::string lookupLocal(const DebuginfodServer& server, const std::string& buildId) const;
+  std::string fetch(const DebuginfodServer& server, const std::string& buildId) const;
+  int connectTo(const DebuginfodServer& server) const;
+
+  static void* worker(void* arg);
+
+  std::vector<DebuginfodServer> servers_;
+  std::string cachePath_;
+  unsigned timeout_;
+
+  pthread_mutex_t mutex_;
+  /// Build id -> path of debug file, empty path means that nobody has it
+  std::map<std::string, std::string> found_;
+  std::vector<std::string> queue_;
+};
+
+static bool fileExists(const std::string& path)
+{
+  return access(path.c_str(), R_OK) == 0;
+}
+
+static bool isValidBuildId(const std::string& buildId)
+{
+  // Build id is used as part of paths and URLs, so allow only hex digits here
+  if (buildId.size() < 2)
+    return false;
+  for (std::string::const_iterator it = buildId.begin(); it != buildId.end(); ++it)
+    if (!isxdigit(*it))
+      return false;
+  return true;
+}
+
+static bool makeDirectories(const std::string& path)
+{
+  for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+  {
+    const std::string& dir = path.substr(0, pos);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+      return false;
+    if (pos == std::string::npos)
+      return true;
+  }
+}
+
+static bool writeAll(int fd, const char* data, size_t size, bool isSocket = false)
+{
+  while (size > 0)
+  {
+    // Don't get killed by SIGPIPE if server has closed connection
+    ssize_t written = isSocket ? send(fd, data, size, MSG_NOSIGNAL) : write(fd, data, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+DebuginfodClientPrivate::DebuginfodClientPrivate()
+  : timeout_(defaultTimeout)
+{
+  pthread_mutex_init(&mutex_, 0);
+
+  const char* urls = getenv("DEBUGINFOD_URLS");
+  if (urls)
+    parseServers(urls);
+
+  const char* timeout = getenv("DEBUGINFOD_TIMEOUT");
+  if (timeout && atoi(timeout) > 0)
+    timeout_ = atoi(timeout);
+
+  if (const char* cachePath = getenv("DEBUGINFOD_CACHE_PATH"))
+    cachePath_ = cachePath;
+  else if (const char* xdgCache = getenv("XDG_CACHE_HOME"))
+    cachePath_.append(xdgCache).append("/debuginfod_client");
+  else if (const char* home = getenv("HOME"))
+    cachePath_.append(home).append("/.cache/debuginfod_client");
+  else
+    cachePath_ = "/tmp/debuginfod_client";
+}
+
+DebuginfodClientPrivate::~DebuginfodClientPrivate()
+{
+  pthread_mutex_destroy(&mutex_);
+}
+
+void DebuginfodClientPrivate::parseServers(const char* urls)
+{
+  const std::string all(urls);
+  size_t pos = 0;
+  while (pos < all.size())
+  {
+    size_t end = all.find(' ', pos);
+    if (end == std::string::npos)
+      end = all.size();
+    std::string url = all.substr(pos, end - pos);
+    pos = end + 1;
+
+    while (url.size() > 1 && url[url.size() - 1] == '/')
+      url.erase(url.size() - 1);
+    if (url.empty())
+      continue;
+
+    DebuginfodServer server;
+    if (url.compare(0, 7, "file://") == 0)
+    {
+      server.kind = DebuginfodServer::LocalDirectory;
+      server.path = url.substr(7);
+    }
+    else if (url[0] == '/')
+    {
+      server.kind = DebuginfodServer::LocalDirectory;
+      server.path = url;
+    }
+    else if (url.compare(0, 7, "http://") == 0)
+    {
+      server.kind = DebuginfodServer::Http;
+      size_t pathStart = url.find('/', 7);
+      if (pathStart == std::string::npos)
+        pathStart = url.size();
+      server.host = url.substr(7, pathStart - 7);
+      server.path = url.substr(pathStart);
+      server.port = "80";
+      size_t portStart = server.host.rfind(':');
+      if (portStart != std::string::npos && server.host.find(']', portStart) == std::string::npos)
+      {
+        server.port = server.host.substr(portStart + 1);
+        server.host.erase(portStart);
+      }
+      if (server.host.size() > 2 && server.host[0] == '[')
+        server.host = server.host.substr(1, server.host.size() - 2);
+    }
+    else
+    {
+      // There is no TLS here, https servers have to be reached through http proxy or mirror
+      std::cerr << "Unsupported debuginfod server URL " << url << ", only http:// and local directories work\n";
+      continue;
+    }
+    servers_.push_back(server);
+  }
+}
+
+std::string DebuginfodClientPrivate::find(const std::string& buildId)
+{
+  pthread_mutex_lock(&mutex_);
+  std::map<std::string, std::string>::const_iterator foundIt = found_.find(buildId);
+  bool alreadyKnown = (foundIt != found_.end());
+  std::string result;
+  if (alreadyKnown)
+    result = foundIt->second;
+  pthread_mutex_unlock(&mutex_);
+  if (alreadyKnown)
+    return result;
+
+  const std::string& cachedFile = cachePath_ + '/' + buildId + "/debuginfo";
+  if (fileExists(cachedFile))
+    result = cachedFile;
+
+  for (std::vector<DebuginfodServer>::const_iterator serverIt = servers_.begin();
+       result.empty() && serverIt != servers_.end(); ++serverIt)
+  {
+    if (serverIt->kind == DebuginfodServer::LocalDirectory)
+      result = lookupLocal(*serverIt, buildId);
+    else
+      result = fetch(*serverIt, buildId);
+  }
+
+  pthread_mutex_lock(&mutex_);
+  found_[buildId] = result;
+  pthread_mutex_unlock(&mutex_);
+
+  return result;
+}
+
+std::string DebuginfodClientPrivate::lookupLocal(const DebuginfodServer& server, const std::string& buildId) const
+{
+  std::string path = server.path + "/buildid/" + buildId + "/debuginfo";
+  if (fileExists(path))
+    return path;
+
+  path = server.path + "/.build-id/" + buildId.substr(0, 2) + '/' + buildId.substr(2) + ".debug";
+  if (fileExists(path))
+    return path;
+
+  return std::string();
+}
+
+int DebuginfodClientPrivate::connectTo(const DebuginfodServer& server) const
+{
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo* addresses;
+  if (getaddrinfo(server.host.c_str(), server.port.c_str(), &hints, &addresses) != 0)
+    return -1;
+
+  int fd = -1;
+  for (addrinfo* addr = addresses; addr && fd == -1; addr = addr->ai_next)
+  {
+    fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+    if (fd == -1)
+      continue;
+
+    timeval tv;
+    tv.tv_sec = timeout_;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (connect(fd, addr->ai_addr, addr->ai_addrlen) != 0)
+    {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  freeaddrinfo(addresses);
+  return fd;
+}
+
+/// Finds Content-Length among response headers, header names are case insensitive
+static bool parseContentLength(const std::string& headers, unsigned long long& length)
+{
+  static const char name[] = "\r\ncontent-length:";
+  for (size_t pos = headers.find("\r\n"); pos != std::string::npos; pos = headers.find("\r\n", pos + 2))
+  {
+    if (strncasecmp(headers.c_str() + pos, name, sizeof(name) - 1) != 0)
+      continue;
+    const char* value = headers.c_str() + pos + sizeof(name) - 1;
+    while (*value == ' ' || *value == '\t')
+      ++value;
+    char* end;
+    errno = 0;
+    length = strtoull(value, &end, 10);
+    return end != value && errno == 0 && (*end == '\0' || *end == '\r' || *end == ' ' || *end == '\t');
+  }
+  return false;
+}
+
+std::string DebuginfodClientPrivate::fetch(const DebuginfodServer& server, const std::string& buildId) const
+{
+  int sock = connectTo(server);
+  if (sock == -1)
+  {
+#ifndef NDEBUG
+    std::cerr << "Can't connect to debuginfod server " << server.host << ':' << server.port << '\n';
+#endif
+    return std::string();
+  }
+
+  const std::string& request = "GET " + server.path + "/buildid/" + buildId + "/debuginfo HTTP/1.0\r\n"
+      "Host: " + server.host + "\r\nUser-Agent: perfgrind\r\nConnection: close\r\n\r\n";
+  if (!writeAll(sock, request.data(), request.size(), true))
+  {
+    close(sock);
+    return std::string();
+  }
+
+  // Read response headers, part of body could be read as well
+  std::string response;
+  size_t headerEnd = std::string::npos;
+  char buf[64 * 1024];
+  while (headerEnd == std::string::npos)
+  {
+    ssize_t received = read(sock, buf, sizeof(buf));
+    if (received < 0 && errno == EINTR)
+      continue;
+    if (received <= 0)
+    {
+      close(sock);
+      return std::string();
+    }
+    response.append(buf, received);
+    headerEnd = response.find("\r\n\r\n");
+  }
+
+  // "HTTP/1.x 200 OK"
+  size_t statusStart = response.find(' ');
+  if (statusStart == std::string::npos || atoi(response.c_str() + statusStart + 1) != 200)
+  {
+    close(sock);
+    return std::string();
+  }
+
+  // Body is complete only if it has announced length, connection could drop in the middle of it
+  unsigned long long contentLength = 0;
+  if (!parseContentLength(response.substr(0, headerEnd), contentLength))
+  {
+    close(sock);
+    return std::string();
+  }
+
+  const std::string& cacheDir = cachePath_ + '/' + buildId;
+  if (!makeDirectories(cacheDir))
+  {
+    close(sock);
+    return std::string();
+  }
+
+  // Download into temporary file and rename it when done, so other clients never see partial files
+  char tmpName[PATH_MAX];
+  snprintf(tmpName, sizeof(tmpName), "%s/debuginfo.XXXXXX", cacheDir.c_str());
+  int out = mkstemp(tmpName);
+  if (out == -1)
+  {
+    close(sock);
+    return std::string();
+  }
+
+  unsigned long long size = response.size() - headerEnd - 4;
+  bool ok = writeAll(out, response.data() + headerEnd + 4, size);
+  while (ok)
+  {
+    ssize_t received = read(sock, buf, sizeof(buf));
+    if (received < 0 && errno == EINTR)
+      continue;
+    if (received == 0)
+      break;
+    ok = (received > 0 && writeAll(out, buf, received));
+    size += received;
+  }
+  close(sock);
+  ok = (close(out) == 0) && ok && size == contentLength;
+
+  const std::string& cachedFile = cacheDir + "/debuginfo";
+  if (!ok || rename(tmpName, cachedFile.c_str()) != 0)
+  {
+    unlink(tmpName);
+    return std::string();
+  }
+  chmod(cachedFile.c_str(), 0444);
+
+  return cachedFile;
+}
+
+void* DebuginfodClientPrivate::worker(void* arg)
+{
+  DebuginfodClientPrivate* d = static_cast<DebuginfodClientPrivate*>(arg);
+  while (1)
+  {
+    pthread_mutex_lock(&d->mutex_);
+    if (d->queue_.empty())
+    {
+      pthread_mutex_unlock(&d->mutex_);
+      break;
+    }
+    std::string buildId = d->queue_.back();
+    d->queue_.pop_back();
+    pthread_mutex_unlock(&d->mutex_);
+
+    d->find(buildId);
+  }
+  return 0;
+}
+
+// DebuginfodClient methods
+
+DebuginfodClient::DebuginfodClient()
+  : d(new DebuginfodClientPrivate)
+{}
+
+DebuginfodClient::~DebuginfodClient() { delete d; }
+
+bool DebuginfodClient::enabled() const { return !d->servers_.empty(); }
+
+void DebuginfodClient::prefetch(const std::vector<std::string>& buildIds)
+{
+  if (!enabled())
+    return;
+
+  std::vector<std::string> uniqueIds(buildIds);
+  std::sort(uniqueIds.begin(), uniqueIds.end());
+  uniqueIds.erase(std::unique(uniqueIds.begin(), uniqueIds.end()), uniqueIds.end());
+
+  pthread_mutex_lock(&d->mutex_);
+  for (std::vector<std::string>::const_iterator it = uniqueIds.begin(); it != uniqueIds.end(); ++it)
+    if (isValidBuildId(*it) && d->found_.find(*it) == d->found_.end())
+      d->queue_.push_back(*it);
+  size_t threadCount = std::min<size_t>(d->queue_.size(), maxParallelRequests);
+  pthread_mutex_unlock(&d->mutex_);
+
+  std::vector<pthread_t> threads;
+  for (size_t i = 0; i < threadCount; ++i)
+  {
+    pthread_t thread;
+    if (pthread_create(&thread, 0, &DebuginfodClientPrivate::worker, d) == 0)
+      threads.push_back(thread);
+  }
+  // If no thread was created, do all the work here
+  if (threads.empty())
+    DebuginfodClientPrivate::worker(d);
+
+  for (std::vector<pthread_t>::iterator it = threads.begin(); it != threads.end(); ++it)
+    pthread_join(*it, 0);
+}
+
+std::string DebuginfodClient::findDebugInfo(const std::string& buildId)
+{
+  if (!enabled() || !isValidBuildId(buildId))
+    return std::string();
+  return d->find(buildId);
+}
@@ -0,0 +1,36 @@
+#ifndef DEBUGINFODCLIENT_H
+#define DEBUGINFODCLIENT_H
+
+#include <string>
+#include <vector>
+
+class DebuginfodClientPrivate;
+
+/// Client for debuginfod protocol
+/** Servers are taken from DEBUGINFOD_URLS environment variable (space separated list). Each server
+ *  could be "http://host[:port][/path]" URL or local directory, given as "file:///dir" or just "/dir".
+ *  Local directories are searched both in debuginfod layout (dir/buildid/ID/debuginfo) and in
+ *  build-id layout of /usr/lib/debug (dir/.build-id/XX/YYYY.debug). Files downloaded over HTTP are
+ *  stored in cache directory (DEBUGINFOD_CACHE_PATH, $XDG_CACHE_HOME/debuginfod_client or
+ *  ~/.cache/debuginfod_client), which uses the same layout as elfutils' client. */
+class DebuginfodClient
+{
+public:
+  DebuginfodClient();
+  ~DebuginfodClient();
+
+  bool enabled() const;
+
+  /// Fetch debug files for all build ids using several parallel requests
+  void prefetch(const std::vector<std::string>& buildIds);
+  /// Returns path to debug file or empty string if none of servers has it
+  std::string findDebugInfo(const std::string& buildId);
+
+private:
+  DebuginfodClient(const DebuginfodClient&);
+  DebuginfodClient& operator=(const DebuginfodClient&);
+
+  DebuginfodClientPrivate* d;
+};
+
+#endif // DEBUGINFODCLIENT_H
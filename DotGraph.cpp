@@ -0,0 +1,180 @@
+#include "DotGraph.h"
+#include "OutputBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const size_t noIndex = size_t(-1);
+
+static const double minPenWidth = 0.5;
+static const double maxPenWidth = 4.0;
+static const double minFontSize = 8.0;
+static const double maxFontSize = 24.0;
+
+/// Name of node with costs of dropped symbols
+static const std::string otherName("[other]");
+
+static void writeEscaped(OutputBuffer& os, const std::string& text)
+{
+  for (std::string::const_iterator it = text.begin(); it != text.end(); ++it)
+  {
+    if (*it == '"' || *it == '\\')
+      os << '\\';
+    os << *it;
+  }
+}
+
+static double hueToRgb(double m1, double m2, double h)
+{
+  if (h < 0.0)
+    h += 1.0;
+  else if (h > 1.0)
+    h -= 1.0;
+  if (h * 6 < 1.0)
+    return m1 + (m2 - m1) * h * 6.0;
+  if (h * 2 < 1.0)
+    return m2;
+  if (h * 3 < 2.0)
+    return m1 + (m2 - m1) * (2.0 / 3.0 - h) * 6.0;
+  return m1;
+}
+
+static void writeColorComponent(OutputBuffer& os, double value)
+{
+  static const char digits[] = "0123456789abcdef";
+  unsigned byte = unsigned(value * 255 + 0.5);
+  os << digits[byte >> 4] << digits[byte & 0xf];
+}
+
+/// Writes color of gprof2dot temperature scale, from dark blue for cold to red for hot
+static void writeColor(OutputBuffer& os, double weight)
+{
+  weight = std::min(std::max(weight, 0.0), 1.0);
+  double h = 2.0 / 3.0 - weight * 2.0 / 3.0;
+  double s = 0.8 + weight * 0.2;
+  double l = 0.25 + weight * 0.25;
+
+  double m2 = l * (s + 1.0);
+  double m1 = l * 2.0 - m2;
+  os << '#';
+  writeColorComponent(os, hueToRgb(m1, m2, h + 1.0 / 3.0));
+  writeColorComponent(os, hueToRgb(m1, m2, h));
+  writeColorComponent(os, hueToRgb(m1, m2, h - 1.0 / 3.0));
+}
+
+DotGraph::DotGraph(const Profile& profile, double nodeThreshold, double edgeThreshold)
+{
+  CallGraph graph(profile);
+  nodes_ = graph.nodes();
+  edges_ = graph.edges();
+  total_ = graph.total();
+  prune(nodeThreshold, edgeThreshold);
+}
+
+void DotGraph::prune(double nodeThreshold, double edgeThreshold)
+{
+  Count nodeLimit = Count(std::ceil(total_ * nodeThreshold / 100));
+  Count edgeLimit = Count(std::ceil(total_ * edgeThreshold / 100));
+
+  CallGraph::Node other = { 0, 0, 0, 0, 0 };
+  std::vector<size_t> newIndexes(nodes_.size(), noIndex);
+  CallGraph::NodeStorage::iterator last = nodes_.begin();
+  for (size_t i = 0; i < nodes_.size(); ++i)
+  {
+    if (nodes_[i].inclusive == 0 || nodes_[i].inclusive < nodeLimit)
+    {
+      other.self += nodes_[i].self;
+      continue;
+    }
+    newIndexes[i] = last - nodes_.begin();
+    *last++ = nodes_[i];
+  }
+  nodes_.erase(last, nodes_.end());
+  size_t otherIndex = nodes_.size();
+
+  // Calls from dropped symbols are already in inclusive costs of their callers
+  CallGraph::EdgeStorage::iterator lastEdge = edges_.begin();
+  for (CallGraph::EdgeStorage::const_iterator edgeIt = edges_.begin(); edgeIt != edges_.end(); ++edgeIt)
+  {
+    if (newIndexes[edgeIt->from] == noIndex)
+      continue;
+    CallGraph::Edge edge = { newIndexes[edgeIt->from], newIndexes[edgeIt->to], edgeIt->count };
+    if (edge.to == noIndex)
+      edge.to = otherIndex;
+    *lastEdge++ = edge;
+  }
+  edges_.erase(lastEdge, edges_.end());
+
+  // Several calls to "other" from one caller become one edge
+  std::sort(edges_.begin(), edges_.end());
+  lastEdge = edges_.begin();
+  for (CallGraph::EdgeStorage::const_iterator edgeIt = edges_.begin(); edgeIt != edges_.end(); ++edgeIt)
+  {
+    if (lastEdge != edges_.begin() && lastEdge[-1].from == edgeIt->from && lastEdge[-1].to == edgeIt->to)
+      lastEdge[-1].count += edgeIt->count;
+    else
+      *lastEdge++ = *edgeIt;
+  }
+  edges_.erase(lastEdge, edges_.end());
+
+  lastEdge = edges_.begin();
+  bool otherCalled = false;
+  for (CallGraph::EdgeStorage::const_iterator edgeIt = edges_.begin(); edgeIt != edges_.end(); ++edgeIt)
+  {
+    if (edgeIt->count == 0 || edgeIt->count < edgeLimit)
+      continue;
+    otherCalled = otherCalled || edgeIt->to == otherIndex;
+    *lastEdge++ = *edgeIt;
+  }
+  edges_.erase(lastEdge, edges_.end());
+
+  if (other.self != 0 || otherCalled)
+  {
+    other.inclusive = other.self;
+    nodes_.push_back(other);
+  }
+}
+
+void DotGraph::writeNode(OutputBuffer& os, size_t index) const
+{
+  const CallGraph::Node& node = nodes_[index];
+  double weight = double(node.inclusive) / total_;
+  os << "  n" << index << " [label=\"";
+  writeEscaped(os, node.symbol ? node.symbol->second->name() : otherName);
+  os << "\\n" << Fixed(100.0 * node.inclusive / total_) << "%\\n(" << Fixed(100.0 * node.self / total_)
+     << "%)\", tooltip=\"";
+  writeEscaped(os, node.object ? node.object->fileName() : otherName);
+  os << "\", color=\"";
+  writeColor(os, weight);
+  os << "\", fontsize=\"" << Fixed(std::max(weight * maxFontSize, minFontSize)) << "\"];\n";
+}
+
+void DotGraph::write(OutputBuffer& os) const
+{
+  os << "digraph {\n"
+        "  graph [fontname=Arial, nodesep=0.125, ranksep=0.25];\n"
+        "  node [fontcolor=white, fontname=Arial, height=0, shape=box, style=filled, width=0];\n"
+        "  edge [fontname=Arial];\n";
+  if (total_ == 0)
+  {
+    os << "}\n";
+    return;
+  }
+
+  for (size_t i = 0; i < nodes_.size(); ++i)
+    writeNode(os, i);
+
+  for (CallGraph::EdgeStorage::const_iterator edgeIt = edges_.begin(); edgeIt != edges_.end(); ++edgeIt)
+  {
+    double weight = double(edgeIt->count) / total_;
+    double penWidth = std::max(weight * maxPenWidth, minPenWidth);
+    os << "  n" << edgeIt->from << " -> n" << edgeIt->to << " [label=\"" << Fixed(100.0 * weight) << "%\\n"
+       << edgeIt->count << "\", color=\"";
+    writeColor(os, weight);
+    os << "\", fontcolor=\"";
+    writeColor(os, weight);
+    os << "\", fontsize=\"" << Fixed(std::max(weight * maxFontSize, minFontSize)) << "\", penwidth=\""
+       << Fixed(penWidth) << "\", arrowsize=\"" << Fixed(0.5 * std::sqrt(penWidth)) << "\"];\n";
+  }
+  os << "}\n";
+}
@@ -0,0 +1,29 @@
+#ifndef DOTGRAPH_H
+#define DOTGRAPH_H
+
+#include "CallGraph.h"
+
+class OutputBuffer;
+
+/// Call graph of symbols in Graphviz format, drawn the way gprof2dot does
+/** Nodes and edges are taken from \ref CallGraph. Symbols with inclusive cost below node threshold are dropped and
+ *  their self cost goes to "other" node, as well as calls to them. */
+class DotGraph
+{
+public:
+  /// Thresholds are percents of all samples
+  DotGraph(const Profile& profile, double nodeThreshold, double edgeThreshold);
+
+  void write(OutputBuffer& os) const;
+
+private:
+  void prune(double nodeThreshold, double edgeThreshold);
+  void writeNode(OutputBuffer& os, size_t index) const;
+
+  CallGraph::NodeStorage nodes_;
+  /// Sorted by caller and callee
+  CallGraph::EdgeStorage edges_;
+  Count total_;
+};
+
+#endif // DOTGRAPH_H
@@ -0,0 +1,100 @@
+#include "Filter.h"
+#include "CallGraph.h"
+
+#include <cstring>
+
+static void freeRegexes(std::vector<regex_t*>& regexes)
+{
+  for (std::vector<regex_t*>::iterator regexIt = regexes.begin(); regexIt != regexes.end(); ++regexIt)
+  {
+    regfree(*regexIt);
+    delete *regexIt;
+  }
+}
+
+Filter::~Filter()
+{
+  freeRegexes(includedObjects_);
+  freeRegexes(excludedObjects_);
+  freeRegexes(includedSymbols_);
+  freeRegexes(excludedSymbols_);
+}
+
+bool Filter::include(const char* pattern) { return add(pattern, includedObjects_, includedSymbols_); }
+
+bool Filter::exclude(const char* pattern) { return add(pattern, excludedObjects_, excludedSymbols_); }
+
+bool Filter::add(const char* pattern, RegexStorage& objects, RegexStorage& symbols)
+{
+  RegexStorage* regexes = &symbols;
+  if (strncmp(pattern, "object:", 7) == 0)
+  {
+    regexes = &objects;
+    pattern += 7;
+  }
+  else if (strncmp(pattern, "symbol:", 7) == 0)
+    pattern += 7;
+
+  regex_t* regex = new regex_t;
+  if (regcomp(regex, pattern, REG_EXTENDED | REG_NOSUB) != 0)
+  {
+    delete regex;
+    return false;
+  }
+  regexes->push_back(regex);
+  return true;
+}
+
+bool Filter::matches(const RegexStorage& regexes, const std::string& value)
+{
+  for (RegexStorage::const_iterator regexIt = regexes.begin(); regexIt != regexes.end(); ++regexIt)
+    if (regexec(*regexIt, value.c_str(), 0, 0, 0) == 0)
+      return true;
+  return false;
+}
+
+bool Filter::keeps(const RegexStorage& included, const RegexStorage& excluded, const std::string& value)
+{
+  return (included.empty() || matches(included, value)) && !matches(excluded, value);
+}
+
+void Filter::filterObjects(Profile& profile) const
+{
+  if (includedObjects_.empty() && excludedObjects_.empty())
+    return;
+
+  std::vector<const MemoryObjectData*> folded;
+  const MemoryObjectStorage& objects = profile.memoryObjects();
+  for (MemoryObjectStorage::const_iterator objIt = objects.begin(); objIt != objects.end(); ++objIt)
+    if (!keeps(includedObjects_, excludedObjects_, objIt->second->fileName()))
+      folded.push_back(objIt->second);
+  profile.foldObjects(folded);
+}
+
+void Filter::filterSymbols(Profile& profile) const
+{
+  if (includedSymbols_.empty() && excludedSymbols_.empty() && minCost_ == 0)
+    return;
+
+  std::tr1::unordered_set<const Symbol*> folded;
+  const MemoryObjectStorage& objects = profile.memoryObjects();
+  for (MemoryObjectStorage::const_iterator objIt = objects.begin(); objIt != objects.end(); ++objIt)
+  {
+    const SymbolStorage& symbols = objIt->second->symbols();
+    for (SymbolStorage::const_iterator symIt = symbols.begin(); symIt != symbols.end(); ++symIt)
+      if (!keeps(includedSymbols_, excludedSymbols_, symIt->second->name()))
+        folded.insert(&*symIt);
+  }
+
+  if (minCost_ != 0)
+  {
+    CallGraph graph(profile);
+    Count threshold = Count(graph.total() * minCost_ / 100);
+    const CallGraph::NodeStorage& nodes = graph.nodes();
+    for (CallGraph::NodeStorage::const_iterator nodeIt = nodes.begin(); nodeIt != nodes.end(); ++nodeIt)
+      if (nodeIt->inclusive < threshold)
+        folded.insert(nodeIt->symbol);
+  }
+
+  profile.foldSymbols(folded);
+}
@@ -0,0 +1,49 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "Profile.h"
+
+#include <string>
+#include <vector>
+#include <regex.h>
+
+/// Object and symbol filters of pgconvert, costs of everything filtered out go to "[other]"
+/** Objects are filtered before resolving, so filtered out objects are never resolved. Symbols are filtered by name
+ *  and by inclusive cost after that, so outputs are smaller and calls to filtered out code are still visible. */
+class Filter
+{
+public:
+  Filter() : minCost_(0) {}
+  ~Filter();
+
+  /// Pattern is "object:REGEX" for object paths or "symbol:REGEX" for symbol names, which is default
+  /** Returns false if regular expression is invalid. If there are included objects or symbols, only they are kept. */
+  bool include(const char* pattern);
+  bool exclude(const char* pattern);
+  /// Symbols with inclusive cost below this percent of all samples are filtered out
+  void setMinCost(double percent) { minCost_ = percent; }
+  /// True if nothing is filtered out
+  bool empty() const
+  {
+    return includedObjects_.empty() && excludedObjects_.empty() && includedSymbols_.empty() &&
+        excludedSymbols_.empty() && minCost_ == 0;
+  }
+
+  void filterObjects(Profile& profile) const;
+  void filterSymbols(Profile& profile) const;
+
+private:
+  typedef std::vector<regex_t*> RegexStorage;
+
+  bool add(const char* pattern, RegexStorage& objects, RegexStorage& symbols);
+  static bool matches(const RegexStorage& regexes, const std::string& value);
+  static bool keeps(const RegexStorage& included, const RegexStorage& excluded, const std::string& value);
+
+  RegexStorage includedObjects_;
+  RegexStorage excludedObjects_;
+  RegexStorage includedSymbols_;
+  RegexStorage excludedSymbols_;
+  double minCost_;
+};
+
+#endif // FILTER_H
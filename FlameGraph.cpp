@@ -0,0 +1,280 @@
+#include "FlameGraph.h"
+#include "OutputBuffer.h"
+
+#include <algorithm>
+
+static const unsigned imageWidth = 1200;
+static const unsigned xPad = 10;
+static const unsigned frameHeight = 16;
+static const unsigned fontSize = 12;
+/// Average width of character relative to font size
+static const double fontWidth = 0.59;
+static const unsigned topPad = fontSize * 3;
+static const unsigned bottomPad = fontSize * 2 + 10;
+/// Frames narrower than this are not drawn, they are not visible anyway
+static const double minFrameWidth = 0.1;
+
+/// Root frame with all samples
+static const std::string rootName("all");
+
+static const char script[] =
+  "var svg, frames, details, matched, unzoomButton, searchButton;\n"
+  "var total, fullWidth, xPad, fontWidth;\n"
+  "var searching = false;\n"
+  "function init(evt) {\n"
+  "  svg = document.documentElement;\n"
+  "  frames = document.getElementById(\"frames\");\n"
+  "  details = document.getElementById(\"details\");\n"
+  "  matched = document.getElementById(\"matched\");\n"
+  "  unzoomButton = document.getElementById(\"unzoom\");\n"
+  "  searchButton = document.getElementById(\"search\");\n"
+  "  total = num(svg, \"total\");\n"
+  "  xPad = num(svg, \"xpad\");\n"
+  "  fullWidth = parseFloat(svg.getAttribute(\"width\")) - 2 * xPad;\n"
+  "  fontWidth = num(svg, \"fontwidth\");\n"
+  "  frames.addEventListener(\"click\", function(e) { var g = group(e.target); if (g) zoom(g); });\n"
+  "  frames.addEventListener(\"mouseover\", function(e) { var g = group(e.target); if (g) details.textContent = title(g); });\n"
+  "  frames.addEventListener(\"mouseout\", function(e) { details.textContent = \" \"; });\n"
+  "  unzoomButton.addEventListener(\"click\", unzoom);\n"
+  "  searchButton.addEventListener(\"click\", function(e) { if (searching) resetSearch(); else search(); });\n"
+  "}\n"
+  "function num(node, name) { return parseFloat(node.getAttribute(\"fg:\" + name)); }\n"
+  "function group(node) {\n"
+  "  while (node && node.parentNode !== frames)\n"
+  "    node = node.parentNode;\n"
+  "  return node;\n"
+  "}\n"
+  "function title(g) { return g.getElementsByTagName(\"title\")[0].textContent; }\n"
+  "function name(g) { var t = title(g); return t.substring(0, t.lastIndexOf(\" (\")); }\n"
+  "function place(g, x, width) {\n"
+  "  var rect = g.getElementsByTagName(\"rect\")[0];\n"
+  "  var text = g.getElementsByTagName(\"text\")[0];\n"
+  "  rect.setAttribute(\"x\", x);\n"
+  "  rect.setAttribute(\"width\", width);\n"
+  "  text.setAttribute(\"x\", x + 3);\n"
+  "  var chars = Math.floor((width - 6) / fontWidth);\n"
+  "  var label = name(g);\n"
+  "  if (chars < 3)\n"
+  "    label = \"\";\n"
+  "  else if (label.length > chars)\n"
+  "    label = label.substring(0, chars - 2) + \"..\";\n"
+  "  text.textContent = label;\n"
+  "}\n"
+  "function zoom(target) {\n"
+  "  var x0 = num(target, \"x\"), w0 = num(target, \"w\"), d0 = num(target, \"d\");\n"
+  "  var scale = fullWidth / w0;\n"
+  "  var all = frames.childNodes;\n"
+  "  for (var i = 0; i < all.length; ++i) {\n"
+  "    var g = all[i];\n"
+  "    if (g.nodeType != 1)\n"
+  "      continue;\n"
+  "    var x = num(g, \"x\"), w = num(g, \"w\"), d = num(g, \"d\");\n"
+  "    var visible = (d < d0) ? (x <= x0 && x + w >= x0 + w0) : (x >= x0 && x + w <= x0 + w0);\n"
+  "    g.style.display = visible ? \"\" : \"none\";\n"
+  "    if (!visible)\n"
+  "      continue;\n"
+  "    g.style.opacity = (d < d0) ? \"0.5\" : \"\";\n"
+  "    if (d < d0)\n"
+  "      place(g, xPad, fullWidth);\n"
+  "    else\n"
+  "      place(g, xPad + (x - x0) * scale, w * scale);\n"
+  "  }\n"
+  "  unzoomButton.style.opacity = \"1\";\n"
+  "}\n"
+  "function unzoom() {\n"
+  "  var scale = fullWidth / total;\n"
+  "  var all = frames.childNodes;\n"
+  "  for (var i = 0; i < all.length; ++i) {\n"
+  "    var g = all[i];\n"
+  "    if (g.nodeType != 1)\n"
+  "      continue;\n"
+  "    g.style.display = \"\";\n"
+  "    g.style.opacity = \"\";\n"
+  "    place(g, xPad + num(g, \"x\") * scale, num(g, \"w\") * scale);\n"
+  "  }\n"
+  "  unzoomButton.style.opacity = \"0\";\n"
+  "}\n"
+  "function search() {\n"
+  "  var term = prompt(\"Search for (regular expression):\", \"\");\n"
+  "  if (!term)\n"
+  "    return;\n"
+  "  var re = new RegExp(term);\n"
+  "  var ranges = [];\n"
+  "  var all = frames.childNodes;\n"
+  "  for (var i = 0; i < all.length; ++i) {\n"
+  "    var g = all[i];\n"
+  "    if (g.nodeType != 1 || !re.test(name(g)))\n"
+  "      continue;\n"
+  "    var rect = g.getElementsByTagName(\"rect\")[0];\n"
+  "    rect.setAttribute(\"fg:fill\", rect.getAttribute(\"fill\"));\n"
+  "    rect.setAttribute(\"fill\", \"rgb(230,0,230)\");\n"
+  "    ranges.push([num(g, \"x\"), num(g, \"w\")]);\n"
+  "  }\n"
+  "  // Nested matches should not be counted twice\n"
+  "  ranges.sort(function(a, b) { return a[0] - b[0]; });\n"
+  "  var sum = 0, end = 0;\n"
+  "  for (var i = 0; i < ranges.length; ++i) {\n"
+  "    var start = Math.max(ranges[i][0], end);\n"
+  "    var stop = ranges[i][0] + ranges[i][1];\n"
+  "    if (stop > start) {\n"
+  "      sum += stop - start;\n"
+  "      end = stop;\n"
+  "    }\n"
+  "  }\n"
+  "  searching = true;\n"
+  "  searchButton.textContent = \"Reset Search\";\n"
+  "  matched.textContent = \"Matched: \" + (100 * sum / total).toFixed(2) + \"%\";\n"
+  "}\n"
+  "function resetSearch() {\n"
+  "  var all = frames.getElementsByTagName(\"rect\");\n"
+  "  for (var i = 0; i < all.length; ++i) {\n"
+  "    var fill = all[i].getAttribute(\"fg:fill\");\n"
+  "    if (fill) {\n"
+  "      all[i].setAttribute(\"fill\", fill);\n"
+  "      all[i].removeAttribute(\"fg:fill\");\n"
+  "    }\n"
+  "  }\n"
+  "  searching = false;\n"
+  "  searchButton.textContent = \"Search\";\n"
+  "  matched.textContent = \" \";\n"
+  "}\n";
+
+static void writeEscaped(OutputBuffer& os, const std::string& text)
+{
+  for (std::string::const_iterator it = text.begin(); it != text.end(); ++it)
+  {
+    switch (*it)
+    {
+    case '&': os << "&amp;"; break;
+    case '<': os << "&lt;"; break;
+    case '>': os << "&gt;"; break;
+    case '"': os << "&quot;"; break;
+    default: os << *it;
+    }
+  }
+}
+
+/// Warm colors, which are the same for the same name
+static void writeColor(OutputBuffer& os, const std::string& name)
+{
+  uint32_t hash = 2166136261U;
+  for (std::string::const_iterator it = name.begin(); it != name.end(); ++it)
+    hash = (hash ^ (unsigned char)*it) * 16777619U;
+  os << "rgb(" << 205 + (hash & 0xff) * 50 / 255 << ',' << ((hash >> 8) & 0xff) * 230 / 255 << ','
+     << ((hash >> 16) & 0xff) * 55 / 255 << ')';
+}
+
+FlameGraph::FlameGraph(const FoldedStacks& stacks, Direction direction)
+  : stacks_(stacks)
+  , direction_(direction)
+  , total_(0)
+{
+  const FoldedStacks::ItemStorage& items = stacks_.items();
+  for (FoldedStacks::ItemStorage::const_iterator itemIt = items.begin(); itemIt != items.end(); ++itemIt)
+    total_ += itemIt->second;
+}
+
+void FlameGraph::writeHeader(OutputBuffer& os, size_t maxDepth) const
+{
+  unsigned height = maxDepth * frameHeight + topPad + bottomPad;
+  os << "<?xml version=\"1.0\" standalone=\"no\"?>\n"
+        "<svg version=\"1.1\" width=\"" << imageWidth << "\" height=\"" << height << "\" viewBox=\"0 0 "
+     << imageWidth << ' ' << height << "\" onload=\"init(evt)\" xmlns=\"http://www.w3.org/2000/svg\" "
+        "xmlns:fg=\"urn:perfgrind:flamegraph\" fg:total=\"" << total_ << "\" fg:xpad=\"" << xPad
+     << "\" fg:fontwidth=\"" << Fixed(fontSize * fontWidth) << "\">\n"
+        "<style type=\"text/css\">\n"
+        "text { font-family: Verdana, sans-serif; font-size: " << fontSize << "px; fill: rgb(0,0,0); }\n"
+        "#title { text-anchor: middle; font-size: " << fontSize + 5 << "px; }\n"
+        "#search, #unzoom { cursor: pointer; }\n"
+        "#frames > g { cursor: pointer; }\n"
+        "#frames > g:hover > rect { stroke: black; stroke-width: 0.5; }\n"
+        "#frames text { pointer-events: none; }\n"
+        "</style>\n"
+        "<script type=\"text/ecmascript\"><![CDATA[\n" << script << "]]></script>\n"
+        "<rect x=\"0\" y=\"0\" width=\"100%\" height=\"100%\" fill=\"rgb(248,248,248)\"/>\n"
+        "<text id=\"title\" x=\"" << imageWidth / 2 << "\" y=\"" << fontSize * 2 << "\">"
+     << (direction_ == Flame ? "Flame Graph" : "Icicle Graph") << "</text>\n"
+        "<text id=\"unzoom\" x=\"" << xPad << "\" y=\"" << fontSize * 2 << "\" style=\"opacity: 0\">Reset Zoom</text>\n"
+        "<text id=\"search\" x=\"" << imageWidth - xPad - 100 << "\" y=\"" << fontSize * 2 << "\">Search</text>\n"
+        "<text id=\"matched\" x=\"" << imageWidth - xPad - 100 << "\" y=\"" << height - fontSize << "\"> </text>\n"
+        "<text id=\"details\" x=\"" << xPad << "\" y=\"" << height - fontSize << "\"> </text>\n"
+        "<g id=\"frames\">\n";
+}
+
+void FlameGraph::writeFrame(OutputBuffer& os, const std::string& name, Count start, Count width, size_t depth,
+                            size_t maxDepth) const
+{
+  double scale = double(imageWidth - 2 * xPad) / total_;
+  double pixelWidth = width * scale;
+  if (pixelWidth < minFrameWidth)
+    return;
+
+  double x = xPad + start * scale;
+  unsigned y = (direction_ == Flame) ? topPad + (maxDepth - depth - 1) * frameHeight : topPad + depth * frameHeight;
+
+  os << "<g fg:x=\"" << start << "\" fg:w=\"" << width << "\" fg:d=\"" << depth << "\"><title>";
+  writeEscaped(os, name);
+  os << " (" << width << " samples, " << Fixed(100.0 * width / total_) << "%)</title><rect x=\"" << Fixed(x)
+     << "\" y=\"" << y << "\" width=\"" << Fixed(pixelWidth) << "\" height=\"" << frameHeight - 1 << "\" fill=\"";
+  writeColor(os, name);
+  os << "\" rx=\"2\" ry=\"2\"/><text x=\"" << Fixed(x + 3) << "\" y=\"" << y + frameHeight - 4 << "\">";
+
+  // The same label as script makes on zoom
+  int chars = int((pixelWidth - 6) / (fontSize * fontWidth));
+  if (chars >= 3 && name.size() > size_t(chars))
+  {
+    writeEscaped(os, name.substr(0, chars - 2));
+    os << "..";
+  }
+  else if (chars >= 3)
+    writeEscaped(os, name);
+  os << "</text></g>\n";
+}
+
+void FlameGraph::write(OutputBuffer& os) const
+{
+  const FoldedStacks::ItemStorage& items = stacks_.items();
+
+  size_t maxDepth = 0;
+  for (FoldedStacks::ItemStorage::const_iterator itemIt = items.begin(); itemIt != items.end(); ++itemIt)
+    maxDepth = std::max(maxDepth, itemIt->first.size());
+  // Root frame takes one more level
+  maxDepth++;
+  writeHeader(os, maxDepth);
+
+  // Frames of the previous stack, which could be extended by the next one
+  std::vector<OpenFrame> open;
+  Count position = 0;
+  for (FoldedStacks::ItemStorage::const_iterator itemIt = items.begin(); itemIt != items.end(); ++itemIt)
+  {
+    const SymbolStack& stack = itemIt->first;
+    size_t common = 0;
+    while (common < open.size() && common < stack.size() && *open[common].name == stack[common]->second->name())
+      ++common;
+
+    while (open.size() > common)
+    {
+      const OpenFrame& frame = open.back();
+      writeFrame(os, *frame.name, frame.start, position - frame.start, open.size(), maxDepth);
+      open.pop_back();
+    }
+    for (size_t depth = common; depth < stack.size(); ++depth)
+    {
+      OpenFrame frame = { &stack[depth]->second->name(), position };
+      open.push_back(frame);
+    }
+
+    position += itemIt->second;
+  }
+
+  while (!open.empty())
+  {
+    const OpenFrame& frame = open.back();
+    writeFrame(os, *frame.name, frame.start, position - frame.start, open.size(), maxDepth);
+    open.pop_back();
+  }
+  if (total_)
+    writeFrame(os, rootName, 0, total_, 0, maxDepth);
+
+  os << "</g>\n</svg>\n";
+}
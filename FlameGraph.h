@@ -0,0 +1,38 @@
+#ifndef FLAMEGRAPH_H
+#define FLAMEGRAPH_H
+
+#include "FoldedStacks.h"
+
+class OutputBuffer;
+
+/// Renders folded stacks into interactive SVG flame graph
+/** Layout is done in one pass over stacks sorted by names: stacks, which share prefix with previous one, extend its
+ *  frames, other frames are closed and written out. Layout itself keeps only frames of current stack, memory is
+ *  taken by \ref FoldedStacks, which holds every distinct resolved stack. Zoom, search and frame details are done by
+ *  JavaScript embedded into SVG. Icicle graph is flame graph upside down, with the outermost frames at the top. */
+class FlameGraph
+{
+public:
+  enum Direction { Flame, Icicle };
+
+  FlameGraph(const FoldedStacks& stacks, Direction direction);
+
+  void write(OutputBuffer& os) const;
+
+private:
+  struct OpenFrame
+  {
+    const std::string* name;
+    Count start;
+  };
+
+  void writeHeader(OutputBuffer& os, size_t maxDepth) const;
+  void writeFrame(OutputBuffer& os, const std::string& name, Count start, Count width, size_t depth,
+                  size_t maxDepth) const;
+
+  const FoldedStacks& stacks_;
+  Direction direction_;
+  Count total_;
+};
+
+#endif // FLAMEGRAPH_H
@@ -0,0 +1,102 @@
+#include "FoldedStacks.h"
+#include "OutputBuffer.h"
+
+#include <algorithm>
+
+/// Compares stacks by symbol names frame by frame, so common prefixes of flame graph are next to each other
+struct SymbolStackLess
+{
+  bool operator()(const FoldedStacks::Item& lhs, const FoldedStacks::Item& rhs) const
+  {
+    const SymbolStack& left = lhs.first;
+    const SymbolStack& right = rhs.first;
+    size_t size = std::min(left.size(), right.size());
+    for (size_t i = 0; i < size; ++i)
+    {
+      if (left[i] == right[i])
+        continue;
+      int cmp = left[i]->second->name().compare(right[i]->second->name());
+      if (cmp != 0)
+        return cmp < 0;
+    }
+    return left.size() < right.size();
+  }
+};
+
+static bool sameNames(const SymbolStack& left, const SymbolStack& right)
+{
+  if (left.size() != right.size())
+    return false;
+  for (size_t i = 0; i < left.size(); ++i)
+    if (left[i] != right[i] && left[i]->second->name() != right[i]->second->name())
+      return false;
+  return true;
+}
+
+void StackResolver::resolve(const Stack& stack, SymbolStack& symbolStack)
+{
+  symbolStack.clear();
+  for (Stack::const_reverse_iterator frameIt = stack.rbegin(); frameIt != stack.rend(); ++frameIt)
+  {
+    std::pair<std::tr1::unordered_map<Address, const Symbol*>::iterator, bool> insResult =
+        symbols_.insert(std::make_pair(*frameIt, (const Symbol*)0));
+    if (insResult.second)
+    {
+      if (const MemoryObject* object = objects_.find(*frameIt))
+      {
+        SymbolStorage::const_iterator symIt = object->second->symbols().find(Range(*frameIt));
+        if (symIt != object->second->symbols().end())
+          insResult.first->second = &*symIt;
+      }
+    }
+    if (insResult.first->second)
+      symbolStack.push_back(insResult.first->second);
+  }
+}
+
+FoldedStacks::FoldedStacks(const Profile& profile)
+{
+  StackResolver resolver(profile);
+  std::tr1::unordered_map<SymbolStack, Count, SymbolStackHash> folded;
+
+  SymbolStack symbolStack;
+  const StackStorage& stacks = profile.stacks();
+  for (StackStorage::const_iterator stackIt = stacks.begin(); stackIt != stacks.end(); ++stackIt)
+  {
+    resolver.resolve(stackIt->first, symbolStack);
+    if (!symbolStack.empty())
+      folded[symbolStack] += stackIt->second;
+  }
+
+  items_.assign(folded.begin(), folded.end());
+  std::sort(items_.begin(), items_.end(), SymbolStackLess());
+
+  // Different symbols could have the same name, e.g. static functions of different objects
+  ItemStorage::iterator last = items_.begin();
+  for (ItemStorage::iterator it = items_.begin(); it != items_.end(); ++it)
+  {
+    if (it == last)
+      continue;
+    if (sameNames(last->first, it->first))
+      last->second += it->second;
+    else
+      *++last = *it;
+  }
+  if (!items_.empty())
+    items_.erase(++last, items_.end());
+}
+
+void FoldedStacks::write(OutputBuffer& os) const
+{
+  for (ItemStorage::const_iterator itemIt = items_.begin(); itemIt != items_.end(); ++itemIt)
+  {
+    const SymbolStack& stack = itemIt->first;
+    for (SymbolStack::const_iterator frameIt = stack.begin(); frameIt != stack.end(); ++frameIt)
+    {
+      if (frameIt != stack.begin())
+        os << ';';
+      os << (*frameIt)->second->name();
+    }
+    os << ' ' << itemIt->second << '\n';
+  }
+}
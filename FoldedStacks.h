@@ -0,0 +1,63 @@
+#ifndef FOLDEDSTACKS_H
+#define FOLDEDSTACKS_H
+
+#include "Profile.h"
+
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+class OutputBuffer;
+
+/// Symbols of stack, outermost frame first
+typedef std::vector<const Symbol*> SymbolStack;
+
+struct SymbolStackHash
+{
+  size_t operator()(const SymbolStack& stack) const
+  {
+    // FNV-1a over symbol addresses
+    uint64_t hash = 14695981039346656037ULL;
+    for (SymbolStack::const_iterator it = stack.begin(); it != stack.end(); ++it)
+      hash = (hash ^ reinterpret_cast<uintptr_t>(*it)) * 1099511628211ULL;
+    return hash;
+  }
+};
+
+/// Resolves address stacks into symbol ones, each address is looked up in memory objects and symbols only once
+class StackResolver
+{
+public:
+  explicit StackResolver(const Profile& profile) : objects_(profile.memoryObjects()) {}
+
+  /// Unresolved frames are skipped, as they were dropped from entries too
+  void resolve(const Stack& stack, SymbolStack& symbolStack);
+
+private:
+  ObjectFinder objects_;
+  std::tr1::unordered_map<Address, const Symbol*> symbols_;
+};
+
+/// Stacks of profile resolved to symbols and aggregated, as flame graphs need them
+/** Every distinct address stack of \ref Profile::stacks() is resolved once, stacks, which are equal after
+ *  resolving, are summed up. Profile should be loaded with \ref Profile::setKeepStacks(). Memory is proportional
+ *  to number of distinct resolved stacks times their depth, not to number of samples. */
+class FoldedStacks
+{
+public:
+  typedef std::pair<SymbolStack, Count> Item;
+  typedef std::vector<Item> ItemStorage;
+
+  explicit FoldedStacks(const Profile& profile);
+
+  /// Stacks sorted by names of their symbols
+  const ItemStorage& items() const { return items_; }
+
+  /// Writes "outer;inner count" lines, which are understood by flamegraph.pl and many other tools
+  void write(OutputBuffer& os) const;
+
+private:
+  ItemStorage items_;
+};
+
+#endif // FOLDEDSTACKS_H
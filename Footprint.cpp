@@ -0,0 +1,148 @@
+#include "Footprint.h"
+#include "OutputBuffer.h"
+
+#include <algorithm>
+#include <functional>
+
+static const unsigned lineShift = 6;
+static const unsigned pageShift = 12;
+static const unsigned regionShift = 21;
+
+/// Hottest pages listed for every object and symbols listed for every page
+static const size_t hotPages = 5;
+static const size_t pageSymbols = 3;
+
+static const double coverageLevels[] = { 0.5, 0.9, 0.99, 1.0 };
+static const size_t coverageLevelCount = sizeof(coverageLevels) / sizeof(coverageLevels[0]);
+
+/// Adds count to unit of address, entries come sorted by address, so the same unit is always the last one
+static void addToUnit(std::vector<std::pair<Count, Address> >& units, Address address, unsigned shift, Count count)
+{
+  Address unit = address >> shift << shift;
+  if (units.empty() || units.back().second != unit)
+    units.push_back(std::make_pair(Count(0), unit));
+  units.back().first += count;
+}
+
+void Footprint::collect(const EntryStorage& entries, Units& units)
+{
+  for (EntryStorage::const_iterator entryIt = entries.begin(); entryIt != entries.end(); ++entryIt)
+  {
+    Count count = entryIt->second->count();
+    if (!count)
+      continue;
+    addToUnit(units.lines, entryIt->first, lineShift, count);
+    addToUnit(units.pages, entryIt->first, pageShift, count);
+    addToUnit(units.regions, entryIt->first, regionShift, count);
+    units.total += count;
+  }
+}
+
+void Footprint::sort(Units& units)
+{
+  std::sort(units.lines.begin(), units.lines.end(), std::greater<std::pair<Count, Address> >());
+  std::sort(units.pages.begin(), units.pages.end(), std::greater<std::pair<Count, Address> >());
+  std::sort(units.regions.begin(), units.regions.end(), std::greater<std::pair<Count, Address> >());
+}
+
+void Footprint::writeCoverage(OutputBuffer& os, const Units& units)
+{
+  os << "  Hot 64 byte lines: " << units.lines.size() << ", 4 KiB pages: " << units.pages.size()
+     << ", 2 MiB regions: " << units.regions.size() << "\n"
+        "  Hottest units covering      50%      90%      99%     100% of samples\n";
+
+  const char* names[] = { "    64 byte lines    ", "    4 KiB pages      ", "    2 MiB regions    " };
+  const std::vector<std::pair<Count, Address> >* levels[] = { &units.lines, &units.pages, &units.regions };
+  for (size_t i = 0; i < 3; ++i)
+  {
+    os << names[i];
+    const std::vector<std::pair<Count, Address> >& sorted = *levels[i];
+    size_t used = 0;
+    Count covered = 0;
+    for (size_t level = 0; level < coverageLevelCount; ++level)
+    {
+      while (used < sorted.size() && covered < coverageLevels[level] * units.total)
+        covered += sorted[used++].first;
+      os << Padded(used, 9);
+    }
+    os << '\n';
+  }
+}
+
+void Footprint::writeHotPages(OutputBuffer& os, const MemoryObjectData& object, const Units& units) const
+{
+  const EntryStorage& entries = object.entries();
+  const SymbolStorage& symbols = object.symbols();
+  os << "  Hottest pages:\n";
+  for (size_t i = 0; i < std::min(hotPages, units.pages.size()); ++i)
+  {
+    Address page = units.pages[i].second;
+    os << "    0x" << Hex(page) << Padded(units.pages[i].first, 10) << "  "
+       << Percent(units.pages[i].first, units.total, 0) << "  ";
+
+    // Symbols of page by their samples within it
+    std::vector<std::pair<Count, const Symbol*> > pageSymbolCounts;
+    SymbolStorage::const_iterator symIt = symbols.end();
+    for (EntryStorage::const_iterator entryIt = entries.lower_bound(page);
+         entryIt != entries.end() && entryIt->first < page + (1 << pageShift); ++entryIt)
+    {
+      if (symIt == symbols.end() || entryIt->first >= symIt->first.end)
+      {
+        symIt = symbols.find(Range(entryIt->first));
+        if (symIt == symbols.end())
+          continue;
+        pageSymbolCounts.push_back(std::make_pair(Count(0), &*symIt));
+      }
+      pageSymbolCounts.back().first += entryIt->second->count();
+    }
+    size_t shown = std::min(pageSymbols, pageSymbolCounts.size());
+    std::partial_sort(pageSymbolCounts.begin(), pageSymbolCounts.begin() + shown, pageSymbolCounts.end(),
+                      std::greater<std::pair<Count, const Symbol*> >());
+    for (size_t j = 0; j < shown; ++j)
+      os << (j ? ", " : "") << pageSymbolCounts[j].second->second->name();
+    if (pageSymbolCounts.size() > shown)
+      os << ", ... " << pageSymbolCounts.size() - shown << " more";
+    os << '\n';
+  }
+}
+
+void Footprint::write(OutputBuffer& os) const
+{
+  const MemoryObjectStorage& objects = profile_.memoryObjects();
+  Units all;
+  all.total = 0;
+  std::vector<Units> objectUnits(objects.size());
+  std::vector<const MemoryObjectData*> objectData;
+  // Objects with samples, the hottest first, by their index in objectUnits
+  std::vector<std::pair<Count, size_t> > order;
+  for (MemoryObjectStorage::const_iterator objIt = objects.begin(); objIt != objects.end(); ++objIt)
+  {
+    Units& units = objectUnits[objectData.size()];
+    units.total = 0;
+    collect(objIt->second->entries(), units);
+    if (units.total)
+    {
+      // Objects don't overlap, so their units are distinct
+      all.lines.insert(all.lines.end(), units.lines.begin(), units.lines.end());
+      all.pages.insert(all.pages.end(), units.pages.begin(), units.pages.end());
+      all.regions.insert(all.regions.end(), units.regions.begin(), units.regions.end());
+      all.total += units.total;
+      sort(units);
+      order.push_back(std::make_pair(units.total, objectData.size()));
+    }
+    objectData.push_back(objIt->second);
+  }
+  sort(all);
+  std::sort(order.begin(), order.end(), std::greater<std::pair<Count, size_t> >());
+
+  os << "All objects, " << all.total << " samples\n";
+  writeCoverage(os, all);
+
+  for (std::vector<std::pair<Count, size_t> >::const_iterator it = order.begin(); it != order.end(); ++it)
+  {
+    const MemoryObjectData& object = *objectData[it->second];
+    os << "\nObject " << object.fileName() << ", " << it->first << " samples\n";
+    writeCoverage(os, objectUnits[it->second]);
+    writeHotPages(os, object, objectUnits[it->second]);
+  }
+}
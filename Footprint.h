@@ -0,0 +1,40 @@
+#ifndef FOOTPRINT_H
+#define FOOTPRINT_H
+
+#include "Profile.h"
+
+#include <vector>
+
+class OutputBuffer;
+
+/// Report of code footprint: how many cache lines, pages and huge pages of code get samples
+/** For every object and for all of them together it counts distinct 64 byte lines, 4 KiB pages and 2 MiB regions
+ *  with samples and how many of the hottest ones cover 50%, 90% and 99% of samples. The hottest pages are listed
+ *  with their symbols. Small number of pages covering most samples means huge page remapping of text pays off,
+ *  many pages with few samples each mean code layout should be improved first. */
+class Footprint
+{
+public:
+  explicit Footprint(const Profile& profile) : profile_(profile) {}
+
+  void write(OutputBuffer& os) const;
+
+private:
+  /// Samples of every line, page and region, the hottest first
+  struct Units
+  {
+    std::vector<std::pair<Count, Address> > lines;
+    std::vector<std::pair<Count, Address> > pages;
+    std::vector<std::pair<Count, Address> > regions;
+    Count total;
+  };
+
+  static void collect(const EntryStorage& entries, Units& units);
+  static void sort(Units& units);
+  static void writeCoverage(OutputBuffer& os, const Units& units);
+  void writeHotPages(OutputBuffer& os, const MemoryObjectData& object, const Units& units) const;
+
+  const Profile& profile_;
+};
+
+#endif // FOOTPRINT_H
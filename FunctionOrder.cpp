@@ -0,0 +1,152 @@
+#include "FunctionOrder.h"
+#include "OutputBuffer.h"
+
+#include <algorithm>
+
+/// Clusters are not grown beyond huge page, as it is the biggest unit of locality left to gain
+static const Size maxClusterSize = 2 << 20;
+
+namespace
+{
+
+struct Cluster
+{
+  std::vector<size_t> members;
+  Size size;
+  Count samples;
+};
+
+/// Hotter functions are clustered first, the same way as they are in C3
+struct HotterNode
+{
+  explicit HotterNode(const CallGraph::Node* nodes) : nodes_(nodes) {}
+  bool operator()(size_t lhs, size_t rhs) const
+  {
+    if (nodes_[lhs].self != nodes_[rhs].self)
+      return nodes_[lhs].self > nodes_[rhs].self;
+    if (nodes_[lhs].inclusive != nodes_[rhs].inclusive)
+      return nodes_[lhs].inclusive > nodes_[rhs].inclusive;
+    return lhs < rhs;
+  }
+  const CallGraph::Node* nodes_;
+};
+
+struct DenserCluster
+{
+  bool operator()(const Cluster* lhs, const Cluster* rhs) const
+  {
+    // Compare samples / size without division
+    double left = double(lhs->samples) * std::max<Size>(rhs->size, 1);
+    double right = double(rhs->samples) * std::max<Size>(lhs->size, 1);
+    if (left != right)
+      return left > right;
+    return lhs->members.front() < rhs->members.front();
+  }
+};
+
+}
+
+FunctionOrder::FunctionOrder(const Profile& profile)
+{
+  CallGraph graph(profile);
+  const CallGraph::NodeStorage& nodes = graph.nodes();
+  // Symbols of one object are next to each other
+  size_t first = 0;
+  for (size_t i = 1; i <= nodes.size(); ++i)
+  {
+    if (i < nodes.size() && nodes[i].object == nodes[first].object)
+      continue;
+    const std::string& fileName = nodes[first].object->fileName();
+    // Objects without file have names in brackets, they are not linked
+    if (!fileName.empty() && fileName[0] != '[')
+      orderObject(graph, first, i);
+    first = i;
+  }
+}
+
+void FunctionOrder::orderObject(const CallGraph& graph, size_t first, size_t last)
+{
+  const CallGraph::NodeStorage& nodes = graph.nodes();
+  const CallGraph::EdgeStorage& edges = graph.edges();
+  size_t count = last - first;
+
+  // The most frequent caller within the same object
+  std::vector<size_t> callers(count, size_t(-1));
+  std::vector<Count> callerWeights(count, 0);
+  CallGraph::Edge firstEdge = { first, 0, 0 };
+  for (CallGraph::EdgeStorage::const_iterator edgeIt = std::lower_bound(edges.begin(), edges.end(), firstEdge);
+       edgeIt != edges.end() && edgeIt->from < last; ++edgeIt)
+  {
+    if (edgeIt->to < first || edgeIt->to >= last || edgeIt->count <= callerWeights[edgeIt->to - first])
+      continue;
+    callers[edgeIt->to - first] = edgeIt->from - first;
+    callerWeights[edgeIt->to - first] = edgeIt->count;
+  }
+
+  std::vector<Cluster> clusters(count);
+  std::vector<size_t> clusterOf(count);
+  std::vector<size_t> hot;
+  for (size_t i = 0; i < count; ++i)
+  {
+    const CallGraph::Node& node = nodes[first + i];
+    clusters[i].members.push_back(i);
+    clusters[i].size = node.symbol->first.end - node.symbol->first.start;
+    clusters[i].samples = node.self;
+    clusterOf[i] = i;
+    // Functions, which were seen on stack only, are executed too
+    if (node.inclusive)
+      hot.push_back(i);
+  }
+  std::sort(hot.begin(), hot.end(), HotterNode(&nodes[first]));
+
+  // Cluster of function goes right after cluster of its caller
+  for (std::vector<size_t>::const_iterator it = hot.begin(); it != hot.end(); ++it)
+  {
+    if (callers[*it] == size_t(-1))
+      continue;
+    Cluster& callee = clusters[clusterOf[*it]];
+    Cluster& caller = clusters[clusterOf[callers[*it]]];
+    if (&callee == &caller || callee.size + caller.size > maxClusterSize)
+      continue;
+    for (std::vector<size_t>::const_iterator memberIt = callee.members.begin(); memberIt != callee.members.end();
+         ++memberIt)
+      clusterOf[*memberIt] = clusterOf[callers[*it]];
+    caller.members.insert(caller.members.end(), callee.members.begin(), callee.members.end());
+    caller.size += callee.size;
+    caller.samples += callee.samples;
+    callee.members.clear();
+  }
+
+  std::vector<const Cluster*> sorted;
+  for (std::vector<Cluster>::const_iterator clusterIt = clusters.begin(); clusterIt != clusters.end(); ++clusterIt)
+    if (!clusterIt->members.empty())
+      sorted.push_back(&*clusterIt);
+  std::sort(sorted.begin(), sorted.end(), DenserCluster());
+
+  Functions functions;
+  for (std::vector<const Cluster*>::const_iterator clusterIt = sorted.begin(); clusterIt != sorted.end();
+       ++clusterIt)
+  {
+    const std::vector<size_t>& members = (*clusterIt)->members;
+    for (std::vector<size_t>::const_iterator memberIt = members.begin(); memberIt != members.end(); ++memberIt)
+    {
+      const CallGraph::Node& node = nodes[first + *memberIt];
+      // PLT entries are made by linker, they could not be ordered
+      if (node.inclusive && !node.symbol->second->isPlt())
+        functions.push_back(node.symbol);
+    }
+  }
+  if (!functions.empty())
+    objects_.push_back(std::make_pair(nodes[first].object, functions));
+}
+
+void FunctionOrder::write(OutputBuffer& os) const
+{
+  for (size_t i = 0; i < objects_.size(); ++i)
+  {
+    os << (i ? "\n# " : "# ") << objects_[i].first->fileName() << '\n';
+    const Functions& functions = objects_[i].second;
+    for (Functions::const_iterator funcIt = functions.begin(); funcIt != functions.end(); ++funcIt)
+      os << (*funcIt)->second->linkageName() << '\n';
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef FUNCTIONORDER_H
+#define FUNCTIONORDER_H
+
+#include "CallGraph.h"
+
+#include <utility>
+#include <vector>
+
+class OutputBuffer;
+
+/// Order of hot functions for linker, so functions calling each other are close and share pages and cache lines
+/** Functions of every object are ordered with call-chain clustering (C3): starting from the hottest function, each
+ *  function is appended to cluster of its most frequent caller while cluster fits into huge page, then clusters are
+ *  sorted by density of samples. Result is a list of linkage names for 'lld --symbol-ordering-file' with
+ *  "# object" comment before functions of each object, functions without samples are left to linker. */
+class FunctionOrder
+{
+public:
+  explicit FunctionOrder(const Profile& profile);
+
+  void write(OutputBuffer& os) const;
+
+private:
+  typedef std::vector<const Symbol*> Functions;
+
+  void orderObject(const CallGraph& graph, size_t first, size_t last);
+
+  std::vector<std::pair<const MemoryObjectData*, Functions> > objects_;
+};
+
+#endif // FUNCTIONORDER_H
@@ -0,0 +1,259 @@
+#include "JitCodeMap.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace jd {
+
+// Format of jitdump files is described in tools/perf/Documentation/jitdump-specification.txt
+
+enum { Magic = 0x4A695444 };
+
+enum RecordType
+{
+  CodeLoad = 0,
+  CodeMove = 1,
+  CodeDebugInfo = 2,
+  CodeClose = 3,
+  CodeUnwindingInfo = 4
+};
+
+/// Timestamps are taken from CPU, not from CLOCK_MONOTONIC
+enum { FlagArchTimestamp = 1 };
+
+struct file_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t totalSize;
+  uint32_t elfMachine;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct record_header
+{
+  uint32_t id;
+  uint32_t totalSize;
+  uint64_t timestamp;
+};
+
+struct code_load
+{
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t codeAddress;
+  uint64_t codeSize;
+  uint64_t codeIndex;
+};
+
+struct code_move
+{
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t oldCodeAddress;
+  uint64_t newCodeAddress;
+  uint64_t codeSize;
+  uint64_t codeIndex;
+};
+
+}
+
+const Address JitCodeMap::syntheticBase;
+const Size JitCodeMap::syntheticSize;
+
+JitCodeMap::JitCodeMap()
+  : nextSyntheticAddress_(syntheticBase)
+{}
+
+bool JitCodeMap::loadPerfMap(const std::string& fileName, uint32_t pid)
+{
+  std::ifstream input(fileName.c_str());
+  if (!input)
+    return false;
+
+  // START SIZE symbolname, numbers are hex without 0x prefix
+  std::string line;
+  while (std::getline(input, line))
+  {
+    std::istringstream ss(line);
+    Address start;
+    Size size;
+    std::string name;
+    ss >> std::hex >> start >> size;
+    ss.ignore(1);
+    std::getline(ss, name);
+    if (!ss.fail() && size != 0)
+      addCodeLoad(0, pid, start, size, name, start);
+  }
+
+  return true;
+}
+
+bool JitCodeMap::loadJitDump(const std::string& fileName)
+{
+  std::ifstream input(fileName.c_str(), std::ios_base::in | std::ios_base::binary);
+  if (!input)
+    return false;
+
+  jd::file_header fileHeader;
+  input.read((char*)&fileHeader, sizeof(fileHeader));
+  if (!input || fileHeader.magic != jd::Magic || fileHeader.totalSize < sizeof(fileHeader))
+    return false;
+  input.seekg(fileHeader.totalSize);
+
+  // We can't match CPU timestamps with sample times, so latest code wins
+  bool haveTime = !(fileHeader.flags & jd::FlagArchTimestamp);
+  std::map<uint64_t, std::string> names;
+
+  std::vector<char> name;
+  jd::record_header header;
+  while (input.read((char*)&header, sizeof(header)) && header.totalSize >= sizeof(header))
+  {
+    std::streampos next = input.tellg() + std::streamoff(header.totalSize - sizeof(header));
+    uint64_t time = haveTime ? header.timestamp : 0;
+
+    if (header.id == jd::CodeLoad)
+    {
+      jd::code_load load;
+      // Code size comes from file, so it is compared with what is left to avoid overflow
+      if (header.totalSize < sizeof(header) + sizeof(load) || !input.read((char*)&load, sizeof(load)) ||
+          load.codeSize > header.totalSize - sizeof(header) - sizeof(load))
+        break;
+      // Code follows name, but we don't need it
+      size_t nameSize = header.totalSize - sizeof(header) - sizeof(load) - load.codeSize;
+      name.resize(nameSize + 1);
+      if (!input.read(&name[0], nameSize))
+        break;
+      name[nameSize] = 0;
+      names[load.codeIndex] = &name[0];
+      addCodeLoad(time, fileHeader.pid, load.codeAddress, load.codeSize, &name[0], load.codeAddress);
+    }
+    else if (header.id == jd::CodeMove)
+    {
+      jd::code_move move;
+      if (header.totalSize < sizeof(header) + sizeof(move) || !input.read((char*)&move, sizeof(move)))
+        break;
+      addCodeLoad(time, fileHeader.pid, move.newCodeAddress, move.codeSize, names[move.codeIndex],
+                  move.oldCodeAddress);
+    }
+    else if (header.id == jd::CodeClose)
+      break;
+
+    input.seekg(next);
+  }
+
+  return true;
+}
+
+void JitCodeMap::addCodeLoad(uint64_t time, uint32_t pid, Address address, Size size, const std::string& name,
+                             Address oldAddress)
+{
+  if (size == 0 || address + size < address || oldAddress + size < oldAddress)
+    return;
+
+  HistoryStorage& history = history_[pid];
+  Version version = { time, address, size, 0 };
+
+  // Moved code isn't at old address anymore, but it is the same code with the same symbol
+  if (oldAddress != address)
+  {
+    const Version* old = findVersion(history, oldAddress, time);
+    if (old && old->start == oldAddress && old->size == size)
+      version.synthetic = old->synthetic;
+    Version gone = { time, oldAddress, size, 0 };
+    addVersion(history, Range(oldAddress, oldAddress + size), gone);
+  }
+
+  if (!version.synthetic && nextSyntheticAddress_ + size <= syntheticBase + syntheticSize)
+  {
+    version.synthetic = nextSyntheticAddress_;
+    Range syntheticRange(nextSyntheticAddress_ - syntheticBase, nextSyntheticAddress_ - syntheticBase + size);
+    symbols_.insert(std::make_pair(syntheticRange, name));
+    // Keep regions aligned, as code usually is
+    nextSyntheticAddress_ += (size + 15) & ~Size(15);
+  }
+
+  // New code replaces everything it overlaps since its time
+  addVersion(history, Range(address, address + size), version);
+}
+
+/// Orders versions by time, versions of the same time stay in order of loading
+struct VersionTimeLess
+{
+  template <class Version>
+  bool operator()(uint64_t time, const Version& version) const { return time < version.since; }
+};
+
+void JitCodeMap::addVersion(HistoryStorage& history, const Range& range, const Version& version)
+{
+  // Ranges crossing ends of new one are split, so every range is either within it or out of it
+  splitHistory(history, range.start);
+  splitHistory(history, range.end);
+
+  Address address = range.start;
+  HistoryStorage::iterator historyIt = history.lower_bound(Range(address));
+  while (address < range.end)
+  {
+    if (historyIt == history.end() || historyIt->first.start > address)
+    {
+      // Nothing was here before
+      Address end = historyIt == history.end() ? range.end : std::min(historyIt->first.start, range.end);
+      history.insert(historyIt, std::make_pair(Range(address, end), VersionStorage(1, version)));
+      address = end;
+      continue;
+    }
+
+    VersionStorage& versions = historyIt->second;
+    versions.insert(std::upper_bound(versions.begin(), versions.end(), version.since, VersionTimeLess()), version);
+    address = historyIt->first.end;
+    ++historyIt;
+  }
+}
+
+void JitCodeMap::splitHistory(HistoryStorage& history, Address address)
+{
+  HistoryStorage::iterator historyIt = history.find(Range(address));
+  if (historyIt == history.end() || historyIt->first.start == address)
+    return;
+
+  Range range = historyIt->first;
+  VersionStorage versions;
+  versions.swap(historyIt->second);
+  history.erase(historyIt);
+  history.insert(std::make_pair(Range(range.start, address), versions));
+  history.insert(std::make_pair(Range(address, range.end), VersionStorage())).first->second.swap(versions);
+}
+
+const JitCodeMap::Version* JitCodeMap::findVersion(const HistoryStorage& history, Address address, uint64_t time)
+{
+  HistoryStorage::const_iterator historyIt = history.find(Range(address));
+  if (historyIt == history.end())
+    return 0;
+  const VersionStorage& versions = historyIt->second;
+  VersionStorage::const_iterator versionIt = std::upper_bound(versions.begin(), versions.end(), time,
+                                                              VersionTimeLess());
+  if (versionIt == versions.begin() || !(--versionIt)->synthetic)
+    return 0;
+  return &*versionIt;
+}
+
+Address JitCodeMap::translate(uint32_t pid, Address address, uint64_t time) const
+{
+  if (pid != 0)
+  {
+    std::map<uint32_t, HistoryStorage>::const_iterator pidIt = history_.find(pid);
+    const Version* version = pidIt != history_.end() ? findVersion(pidIt->second, address, time) : 0;
+    return version ? version->synthetic + (address - version->start) : address;
+  }
+
+  for (std::map<uint32_t, HistoryStorage>::const_iterator pidIt = history_.begin(); pidIt != history_.end(); ++pidIt)
+    if (const Version* version = findVersion(pidIt->second, address, time))
+      return version->synthetic + (address - version->start);
+  return address;
+}
@@ -0,0 +1,70 @@
+#ifndef JITCODEMAP_H
+#define JITCODEMAP_H
+
+#include "Profile.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/// Code generated by JIT compilers, as told by perf-PID.map and jit-PID.dump files
+/** Same addresses could be reused by JIT for different functions during profiling, so every code region gets its
+ *  own place in synthetic address space and samples are translated there according to their time. Regions from
+ *  perf-PID.map don't have time and are active from the very beginning, later regions replace overlapping
+ *  earlier ones of the same process. Moved code keeps its place in synthetic address space.
+ *
+ *  Samples come from per CPU buffers and are not ordered by time, so every address keeps history of its regions
+ *  and sample is translated with region active at its own time. Without comparable times, that is for jitdump
+ *  with CPU timestamps or samples with other clock than CLOCK_MONOTONIC, the latest region wins for all samples. */
+class JitCodeMap
+{
+public:
+  /// Synthetic address space starts far above user space addresses and ends below PERF_CONTEXT_MAX
+  static const Address syntheticBase = 0xfff0000000000000ULL;
+  static const Size syntheticSize = 1ULL << 44;
+
+  JitCodeMap();
+
+  bool empty() const { return history_.empty(); }
+
+  bool loadPerfMap(const std::string& fileName, uint32_t pid);
+  /// Process is taken from file header
+  bool loadJitDump(const std::string& fileName);
+
+  /// Returns address in synthetic address space for JIT code of process at given time, other addresses as is
+  /** Samples without process id pass 0, which matches code of any process, samples without comparable time pass
+   *  ULLONG_MAX, which matches the latest code. */
+  Address translate(uint32_t pid, Address address, uint64_t time) const;
+
+  /// Symbols of all regions, ranges are relative to \ref syntheticBase
+  const std::map<Range, std::string>& symbols() const { return symbols_; }
+
+private:
+  /// Code region, which appeared at some time
+  struct Version
+  {
+    uint64_t since;
+    /// Real range of the whole region
+    Address start;
+    Size size;
+    /// Start of copy of region in synthetic address space, 0 if code is gone
+    Address synthetic;
+  };
+  typedef std::vector<Version> VersionStorage;
+  /// Real addresses, which had the same regions all the time -> their versions in order of time
+  typedef std::map<Range, VersionStorage> HistoryStorage;
+
+  /// Code move leaves oldAddress, for loads it is the same as address
+  void addCodeLoad(uint64_t time, uint32_t pid, Address address, Size size, const std::string& name,
+                   Address oldAddress);
+  static void addVersion(HistoryStorage& history, const Range& range, const Version& version);
+  static void splitHistory(HistoryStorage& history, Address address);
+  static const Version* findVersion(const HistoryStorage& history, Address address, uint64_t time);
+
+  /// Code of every process
+  std::map<uint32_t, HistoryStorage> history_;
+  std::map<Range, std::string> symbols_;
+  Address nextSyntheticAddress_;
+};
+
+#endif // JITCODEMAP_H
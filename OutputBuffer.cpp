@@ -0,0 +1,251 @@
+#include "OutputBuffer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static const size_t bufferSize = 4 * 1024 * 1024;
+static const size_t windowSize = 64 * 1024 * 1024;
+static const size_t initialMemorySize = 64 * 1024;
+
+static const char digitPairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static bool writeAll(int fd, const char* data, size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t written = ::write(fd, data, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+OutputBuffer::OutputBuffer()
+  : fd_(-1)
+  , mode_(Memory)
+  , failed_(false)
+  , buffer_(new char[initialMemorySize])
+  , pos_(buffer_)
+  , end_(buffer_ + initialMemorySize)
+  , windowOffset_(0)
+{}
+
+OutputBuffer::OutputBuffer(int fd, Mode mode)
+  : fd_(fd)
+  , mode_(mode)
+  , failed_(false)
+  , buffer_(0)
+  , pos_(0)
+  , end_(0)
+  , windowOffset_(0)
+{
+  if (mode_ == Mmap)
+    mapNextWindow();
+  if (mode_ == Write)
+  {
+    buffer_ = pos_ = new char[bufferSize];
+    end_ = buffer_ + bufferSize;
+  }
+}
+
+OutputBuffer::~OutputBuffer()
+{
+  flush();
+  if (mode_ != Mmap)
+    delete[] buffer_;
+}
+
+void OutputBuffer::mapNextWindow()
+{
+  // Reserve space first, otherwise we will get SIGBUS instead of error when disk is full
+  void* window = MAP_FAILED;
+  bool allocated = (posix_fallocate(fd_, windowOffset_, windowSize) == 0);
+  if (allocated)
+    window = mmap(0, windowSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, windowOffset_);
+
+  if (window == MAP_FAILED)
+  {
+    // Not a regular file or no space left, continue with plain writes after already mapped data
+    if ((allocated || windowOffset_ != 0) &&
+        (ftruncate(fd_, windowOffset_) != 0 || lseek(fd_, windowOffset_, SEEK_SET) == -1))
+      failed_ = true;
+    mode_ = Write;
+    buffer_ = pos_ = end_ = 0;
+    return;
+  }
+
+  buffer_ = pos_ = static_cast<char*>(window);
+  end_ = buffer_ + windowSize;
+}
+
+void OutputBuffer::flushBuffer()
+{
+  if (mode_ == Memory)
+  {
+    size_t size = pos_ - buffer_;
+    size_t newSize = (end_ - buffer_) * 2;
+    char* newBuffer = new char[newSize];
+    memcpy(newBuffer, buffer_, size);
+    delete[] buffer_;
+    buffer_ = newBuffer;
+    pos_ = buffer_ + size;
+    end_ = buffer_ + newSize;
+    return;
+  }
+
+  if (mode_ == Mmap)
+  {
+    munmap(buffer_, windowSize);
+    windowOffset_ += windowSize;
+    mapNextWindow();
+    if (mode_ == Mmap)
+      return;
+
+    buffer_ = pos_ = new char[bufferSize];
+    end_ = buffer_ + bufferSize;
+    return;
+  }
+
+  if (!failed_ && !writeAll(fd_, buffer_, pos_ - buffer_))
+    failed_ = true;
+  pos_ = buffer_;
+}
+
+void OutputBuffer::writeSlow(const char* data, size_t size)
+{
+  while (size > 0)
+  {
+    if (pos_ == end_)
+      flushBuffer();
+    size_t chunkSize = std::min(size, size_t(end_ - pos_));
+    memcpy(pos_, data, chunkSize);
+    pos_ += chunkSize;
+    data += chunkSize;
+    size -= chunkSize;
+  }
+}
+
+bool OutputBuffer::flush()
+{
+  if (mode_ == Memory)
+    return true;
+
+  if (mode_ == Mmap)
+  {
+    // Cut file to real size and continue with plain writes, mmap needs page aligned offsets
+    uint64_t fileSize = windowOffset_ + (pos_ - buffer_);
+    munmap(buffer_, windowSize);
+    if (ftruncate(fd_, fileSize) != 0 || lseek(fd_, fileSize, SEEK_SET) == -1)
+      failed_ = true;
+    mode_ = Write;
+    buffer_ = pos_ = new char[bufferSize];
+    end_ = buffer_ + bufferSize;
+    return !failed_;
+  }
+
+  flushBuffer();
+  return !failed_;
+}
+
+OutputBuffer& OutputBuffer::operator<<(uint64_t value)
+{
+  char digits[20];
+  char* first = digits + sizeof(digits);
+  while (value >= 100)
+  {
+    const char* pair = digitPairs + (value % 100) * 2;
+    value /= 100;
+    *--first = pair[1];
+    *--first = pair[0];
+  }
+  if (value >= 10)
+  {
+    *--first = digitPairs[value * 2 + 1];
+    *--first = digitPairs[value * 2];
+  }
+  else
+    *--first = '0' + value;
+
+  write(first, digits + sizeof(digits) - first);
+  return *this;
+}
+
+OutputBuffer& OutputBuffer::operator<<(int64_t value)
+{
+  if (value < 0)
+    return *this << '-' << (~uint64_t(value) + 1);
+  return *this << uint64_t(value);
+}
+
+OutputBuffer& OutputBuffer::operator<<(Hex value)
+{
+  char digits[16];
+  char* first = digits + sizeof(digits);
+  do
+  {
+    *--first = hexDigits[value.value & 0xf];
+    value.value >>= 4;
+  }
+  while (value.value);
+
+  write(first, digits + sizeof(digits) - first);
+  return *this;
+}
+
+OutputBuffer& OutputBuffer::operator<<(Fixed value)
+{
+  uint64_t hundredths = uint64_t(value.value * 100 + 0.5);
+  *this << hundredths / 100 << '.' << char('0' + hundredths / 10 % 10) << char('0' + hundredths % 10);
+  return *this;
+}
+
+OutputBuffer& OutputBuffer::operator<<(Padding value)
+{
+  for (unsigned used = value.used; used < value.width; ++used)
+    *this << ' ';
+  return *this;
+}
+
+OutputBuffer& OutputBuffer::operator<<(Padded value)
+{
+  return *this << Padding(value.width, decimalDigits(value.value)) << value.value;
+}
+
+OutputBuffer& OutputBuffer::operator<<(Percent value)
+{
+  double percent = value.total ? 100.0 * value.value / value.total : 0.0;
+  // Point, two decimal places and '%' follow integer part
+  return *this << Padding(value.width, decimalDigits(uint64_t(percent + 0.005)) + 4) << Fixed(percent) << '%';
+}
+
+OutputBuffer& OutputBuffer::operator<<(BaseName value)
+{
+  size_t slash = value.path.rfind('/');
+  size_t start = slash == std::string::npos ? 0 : slash + 1;
+  write(value.path.data() + start, value.path.size() - start);
+  return *this;
+}
+
+unsigned decimalDigits(uint64_t value)
+{
+  unsigned result = 1;
+  for (; value >= 10; value /= 10)
+    ++result;
+  return result;
+}
@@ -0,0 +1,128 @@
+#ifndef OUTPUTBUFFER_H
+#define OUTPUTBUFFER_H
+
+#include <string>
+#include <cstring>
+#include <stdint.h>
+
+/// Hexadecimal number for \ref OutputBuffer, written without 0x prefix
+struct Hex
+{
+  explicit Hex(uint64_t _value) : value(_value) {}
+  uint64_t value;
+};
+
+/// Non-negative number for \ref OutputBuffer, written with two decimal places
+struct Fixed
+{
+  explicit Fixed(double _value) : value(_value) {}
+  double value;
+};
+
+/// Spaces for \ref OutputBuffer, which fill text of used length up to width
+struct Padding
+{
+  Padding(unsigned _width, unsigned _used) : width(_width), used(_used) {}
+  unsigned width;
+  unsigned used;
+};
+
+/// Number for \ref OutputBuffer, aligned to the right within width
+struct Padded
+{
+  Padded(uint64_t _value, unsigned _width) : value(_value), width(_width) {}
+  uint64_t value;
+  unsigned width;
+};
+
+/// Share of total for \ref OutputBuffer, written as percent with two decimal places and '%'
+/** Text with '%' is aligned to the right within width. Zero total gives 0.00%. */
+struct Percent
+{
+  Percent(uint64_t _value, uint64_t _total, unsigned _width) : value(_value), total(_total), width(_width) {}
+  uint64_t value;
+  uint64_t total;
+  unsigned width;
+};
+
+/// File name of path for \ref OutputBuffer, without directories
+struct BaseName
+{
+  explicit BaseName(const std::string& _path) : path(_path) {}
+  const std::string& path;
+};
+
+/// Number of decimal digits of value, for alignment of numbers written without \ref Padded
+unsigned decimalDigits(uint64_t value);
+
+/// Output for big text files, which is much faster than std::ostream
+/** Text is collected in a large buffer and written with few big write calls, numbers are formatted without locale
+ *  and manipulators. In mmap mode file is extended by big windows and text is put directly into page cache.
+ *  In memory mode text is only collected in growing buffer, to be written to another OutputBuffer later. */
+class OutputBuffer
+{
+public:
+  enum Mode { Write, Mmap, Memory };
+
+  /// Creates buffer in memory mode
+  OutputBuffer();
+  explicit OutputBuffer(int fd, Mode mode = Write);
+  ~OutputBuffer();
+
+  void write(const char* data, size_t size)
+  {
+    if (size <= size_t(end_ - pos_))
+    {
+      memcpy(pos_, data, size);
+      pos_ += size;
+    }
+    else
+      writeSlow(data, size);
+  }
+
+  OutputBuffer& operator<<(char value)
+  {
+    if (pos_ == end_)
+      flushBuffer();
+    *pos_++ = value;
+    return *this;
+  }
+  OutputBuffer& operator<<(const char* value) { write(value, strlen(value)); return *this; }
+  OutputBuffer& operator<<(const std::string& value) { write(value.data(), value.size()); return *this; }
+  OutputBuffer& operator<<(uint64_t value);
+  OutputBuffer& operator<<(int64_t value);
+  OutputBuffer& operator<<(unsigned value) { return *this << uint64_t(value); }
+  OutputBuffer& operator<<(int value) { return *this << int64_t(value); }
+  OutputBuffer& operator<<(Hex value);
+  OutputBuffer& operator<<(Fixed value);
+  OutputBuffer& operator<<(Padding value);
+  OutputBuffer& operator<<(Padded value);
+  OutputBuffer& operator<<(Percent value);
+  OutputBuffer& operator<<(BaseName value);
+
+  /// Writes everything to file, returns false if some data could not be written
+  bool flush();
+
+  /// Collected text, for memory mode only
+  const char* data() const { return buffer_; }
+  size_t size() const { return pos_ - buffer_; }
+
+private:
+  OutputBuffer(const OutputBuffer&);
+  OutputBuffer& operator=(const OutputBuffer&);
+
+  void writeSlow(const char* data, size_t size);
+  void flushBuffer();
+  void mapNextWindow();
+
+  int fd_;
+  Mode mode_;
+  bool failed_;
+  char* buffer_;
+  char* pos_;
+  char* end_;
+  /// File offset of buffer start in mmap mode
+  uint64_t windowOffset_;
+};
+
+#endif // OUTPUTBUFFER_H
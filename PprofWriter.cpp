@@ -0,0 +1,295 @@
+#include "PprofWriter.h"
+#include "OutputBuffer.h"
+
+#include <string>
+#include <tr1/unordered_map>
+
+namespace pb {
+
+// Field numbers of messages from profile.proto
+
+enum ProfileField
+{
+  ProfileSampleType = 1,
+  ProfileSample = 2,
+  ProfileMapping = 3,
+  ProfileLocation = 4,
+  ProfileFunction = 5,
+  ProfileStringTable = 6,
+  ProfilePeriodType = 11,
+  ProfilePeriod = 12
+};
+
+enum ValueTypeField { ValueTypeType = 1, ValueTypeUnit = 2 };
+
+enum SampleField { SampleLocationId = 1, SampleValue = 2 };
+
+enum MappingField
+{
+  MappingId = 1,
+  MappingMemoryStart = 2,
+  MappingMemoryLimit = 3,
+  MappingFileOffset = 4,
+  MappingFilename = 5,
+  MappingHasFunctions = 7,
+  MappingHasFilenames = 8,
+  MappingHasLineNumbers = 9
+};
+
+enum LocationField { LocationId = 1, LocationMappingId = 2, LocationAddress = 3, LocationLine = 4 };
+
+enum LineField { LineFunctionId = 1, LineLine = 2 };
+
+enum FunctionField
+{
+  FunctionId = 1,
+  FunctionName = 2,
+  FunctionSystemName = 3,
+  FunctionFilename = 4,
+  FunctionStartLine = 5
+};
+
+enum WireType { Varint = 0, LengthDelimited = 2 };
+
+static void appendVarint(std::string& out, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    out.push_back(char(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(char(value));
+}
+
+/// Encoded protobuf message
+class Message
+{
+public:
+  void clear() { data_.clear(); }
+  const std::string& data() const { return data_; }
+
+  Message& varint(unsigned field, uint64_t value)
+  {
+    appendVarint(data_, (field << 3) | Varint);
+    appendVarint(data_, value);
+    return *this;
+  }
+
+  Message& bytes(unsigned field, const std::string& value)
+  {
+    appendVarint(data_, (field << 3) | LengthDelimited);
+    appendVarint(data_, value.size());
+    data_.append(value);
+    return *this;
+  }
+
+  Message& message(unsigned field, const Message& value) { return bytes(field, value.data_); }
+
+  /// Packed repeated varints
+  Message& packed(unsigned field, const std::vector<uint64_t>& values)
+  {
+    packed_.clear();
+    for (std::vector<uint64_t>::const_iterator it = values.begin(); it != values.end(); ++it)
+      appendVarint(packed_, *it);
+    return bytes(field, packed_);
+  }
+
+private:
+  std::string data_;
+  std::string packed_;
+};
+
+}
+
+static const std::string emptyString;
+static const std::string samplesString("samples");
+static const std::string countString("count");
+
+class PprofWriterPrivate
+{
+  friend class PprofWriter;
+  PprofWriterPrivate(OutputBuffer& os, const Profile& profile)
+    : os_(os)
+    , profile_(profile)
+    , objects_(profile.memoryObjects())
+  {}
+
+  /// Writes field of top level Profile message
+  void writeField(unsigned field, const pb::Message& message);
+
+  uint64_t stringId(const std::string& value);
+  uint64_t mappingId(const MemoryObject& object);
+  uint64_t functionId(const Symbol& symbol);
+  /// Returns 0 if address could not be resolved
+  uint64_t locationId(Address address);
+
+  void writeValueType(unsigned field, const std::string& type, const std::string& unit);
+  void writeSample(const Stack& stack, Count count);
+
+  OutputBuffer& os_;
+  const Profile& profile_;
+  ObjectFinder objects_;
+
+  /// Strings live in Profile, so they are identified by address
+  std::tr1::unordered_map<const std::string*, uint64_t> strings_;
+  std::tr1::unordered_map<const MemoryObjectData*, uint64_t> mappings_;
+  std::tr1::unordered_map<const Symbol*, uint64_t> functions_;
+  std::tr1::unordered_map<Address, uint64_t> locations_;
+
+  /// Scratch messages, reused to avoid allocations
+  pb::Message message_;
+  pb::Message line_;
+  std::string header_;
+  std::vector<uint64_t> locationIds_;
+  std::vector<uint64_t> values_;
+};
+
+void PprofWriterPrivate::writeField(unsigned field, const pb::Message& message)
+{
+  header_.clear();
+  pb::appendVarint(header_, (field << 3) | pb::LengthDelimited);
+  pb::appendVarint(header_, message.data().size());
+  os_ << header_ << message.data();
+}
+
+uint64_t PprofWriterPrivate::stringId(const std::string& value)
+{
+  std::pair<std::tr1::unordered_map<const std::string*, uint64_t>::iterator, bool> insResult =
+      strings_.insert(std::make_pair(&value, strings_.size()));
+  if (insResult.second)
+  {
+    header_.clear();
+    pb::appendVarint(header_, (pb::ProfileStringTable << 3) | pb::LengthDelimited);
+    pb::appendVarint(header_, value.size());
+    os_ << header_ << value;
+  }
+  return insResult.first->second;
+}
+
+uint64_t PprofWriterPrivate::mappingId(const MemoryObject& object)
+{
+  std::pair<std::tr1::unordered_map<const MemoryObjectData*, uint64_t>::iterator, bool> insResult =
+      mappings_.insert(std::make_pair(object.second, mappings_.size() + 1));
+  if (insResult.second)
+  {
+    uint64_t fileName = stringId(object.second->fileName());
+    message_.clear();
+    message_.varint(pb::MappingId, insResult.first->second)
+        .varint(pb::MappingMemoryStart, object.first.start)
+        .varint(pb::MappingMemoryLimit, object.first.end)
+        .varint(pb::MappingFileOffset, object.second->fileOffset())
+        .varint(pb::MappingFilename, fileName)
+        .varint(pb::MappingHasFunctions, 1)
+        .varint(pb::MappingHasFilenames, 1)
+        .varint(pb::MappingHasLineNumbers, 1);
+    writeField(pb::ProfileMapping, message_);
+  }
+  return insResult.first->second;
+}
+
+uint64_t PprofWriterPrivate::functionId(const Symbol& symbol)
+{
+  std::pair<std::tr1::unordered_map<const Symbol*, uint64_t>::iterator, bool> insResult =
+      functions_.insert(std::make_pair(&symbol, functions_.size() + 1));
+  if (insResult.second)
+  {
+    uint64_t name = stringId(symbol.second->name());
+    uint64_t fileName = stringId(symbol.second->sourceFile());
+    message_.clear();
+    message_.varint(pb::FunctionId, insResult.first->second)
+        .varint(pb::FunctionName, name)
+        .varint(pb::FunctionSystemName, name)
+        .varint(pb::FunctionFilename, fileName)
+        .varint(pb::FunctionStartLine, symbol.second->sourceLine());
+    writeField(pb::ProfileFunction, message_);
+  }
+  return insResult.first->second;
+}
+
+uint64_t PprofWriterPrivate::locationId(Address address)
+{
+  std::tr1::unordered_map<Address, uint64_t>::const_iterator locIt = locations_.find(address);
+  if (locIt != locations_.end())
+    return locIt->second;
+
+  uint64_t id = 0;
+  const MemoryObject* object = objects_.find(address);
+  if (object)
+  {
+    const SymbolStorage& symbols = object->second->symbols();
+    SymbolStorage::const_iterator symIt = symbols.find(Range(address));
+    if (symIt != symbols.end())
+    {
+      id = locations_.size() + 1;
+      uint64_t mapping = mappingId(*object);
+      uint64_t function = functionId(*symIt);
+
+      // Entries have line of the very address, others get line of symbol
+      const EntryStorage& entries = object->second->entries();
+      EntryStorage::const_iterator entryIt = entries.find(address);
+      size_t line = (entryIt != entries.end()) ? entryIt->second->sourceLine() : symIt->second->sourceLine();
+
+      line_.clear();
+      line_.varint(pb::LineFunctionId, function).varint(pb::LineLine, line);
+      message_.clear();
+      message_.varint(pb::LocationId, id)
+          .varint(pb::LocationMappingId, mapping)
+          .varint(pb::LocationAddress, address)
+          .message(pb::LocationLine, line_);
+      writeField(pb::ProfileLocation, message_);
+    }
+  }
+
+  // Unresolved addresses are remembered too, not to look them up again
+  locations_.insert(std::make_pair(address, id));
+  return id;
+}
+
+void PprofWriterPrivate::writeValueType(unsigned field, const std::string& type, const std::string& unit)
+{
+  uint64_t typeId = stringId(type);
+  uint64_t unitId = stringId(unit);
+  message_.clear();
+  message_.varint(pb::ValueTypeType, typeId).varint(pb::ValueTypeUnit, unitId);
+  writeField(field, message_);
+}
+
+void PprofWriterPrivate::writeSample(const Stack& stack, Count count)
+{
+  locationIds_.clear();
+  for (Stack::const_iterator frameIt = stack.begin(); frameIt != stack.end(); ++frameIt)
+    if (uint64_t id = locationId(*frameIt))
+      locationIds_.push_back(id);
+  if (locationIds_.empty())
+    return;
+
+  values_.assign(1, count);
+  message_.clear();
+  message_.packed(pb::SampleLocationId, locationIds_).packed(pb::SampleValue, values_);
+  writeField(pb::ProfileSample, message_);
+}
+
+// PprofWriter methods
+
+PprofWriter::PprofWriter(OutputBuffer& os, const Profile& profile)
+  : d(new PprofWriterPrivate(os, profile))
+{}
+
+PprofWriter::~PprofWriter() { delete d; }
+
+void PprofWriter::write()
+{
+  // The first string must be empty
+  d->stringId(emptyString);
+  // Stack costs are sums of periods when file has them, so values count events instead of samples
+  const std::string& type = d->profile_.hasSamplePeriods() ? d->profile_.events()[0] : samplesString;
+  d->writeValueType(pb::ProfileSampleType, type, countString);
+  d->writeValueType(pb::ProfilePeriodType, type, countString);
+  d->message_.clear();
+  d->message_.varint(pb::ProfilePeriod, 1);
+  d->os_ << d->message_.data();
+
+  const StackStorage& stacks = d->profile_.stacks();
+  for (StackStorage::const_iterator stackIt = stacks.begin(); stackIt != stacks.end(); ++stackIt)
+    d->writeSample(stackIt->first, stackIt->second);
+}
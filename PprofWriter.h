@@ -0,0 +1,30 @@
+#ifndef PPROFWRITER_H
+#define PPROFWRITER_H
+
+#include "Profile.h"
+
+class OutputBuffer;
+class PprofWriterPrivate;
+
+/// Writes profile in pprof format (profile.proto from github.com/google/pprof)
+/** Memory objects become mappings, symbols become functions and entries become locations with line of source.
+ *  Samples are taken from stacks, so profile should be loaded with \ref Profile::setKeepStacks(). Values are
+ *  weighted by sample periods, as callgrind costs are, and then their type is named after the main event. Message is
+ *  streamed: strings, mappings, functions and locations are written when first sample refers to them, so only
+ *  their ids are kept in memory. */
+class PprofWriter
+{
+public:
+  PprofWriter(OutputBuffer& os, const Profile& profile);
+  ~PprofWriter();
+
+  void write();
+
+private:
+  PprofWriter(const PprofWriter&);
+  PprofWriter& operator=(const PprofWriter&);
+
+  PprofWriterPrivate* d;
+};
+
+#endif // PPROFWRITER_H
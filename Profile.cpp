@@ -1,12 +1,21 @@
 #include "Profile.h"
 
 #include "AddressResolver.h"
+#include "JitCodeMap.h"
+#include "pgdata.h"
 
 #include <algorithm>
+#include <set>
+#include <sstream>
 #include <vector>
 #include <tr1/unordered_set>
 #include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <linux/perf_event.h>
+#include <unistd.h>
 
 #ifndef PERF_MAX_STACK_DEPTH
 #define PERF_MAX_STACK_DEPTH 127
@@ -18,6 +27,15 @@
 
 static const std::string unknownFile("???");
 
+/// Place of "[other]" object in address space, far from real code and JIT code
+static const Address otherAddress = 0xffe0000000000000ULL;
+static const Size otherSize = 16;
+/// Place of "[cycles]" object, one byte for every collapsed cycle
+static const Address cyclesAddress = 0xffe8000000000000ULL;
+
+/// Upper bound of vDSO image size accepted from file
+static const Size maxVdsoSize = 1024 * 1024;
+
 namespace pe {
 
 /// Data about mmap event
@@ -27,19 +45,59 @@ struct mmap_event
   __u32 tid;
   __u64 address;
   __u64 length;
-  /// @todo Determine how to handle pgoff
+  /// Reported as \ref MemoryObjectData::fileOffset()
+  /// @todo Determine how to handle pgoff while resolving
   __u64 pageOffset;
   char fileName[PATH_MAX];
 };
 
 /// Data about sample event
-/** We have enabled only PERF_SAMPLE_IP and PERF_SAMPLE_CALLCHAIN in \ref createPerfEvent in \ref pgcollect.c,
- *  so we define only this small subset of fields. */
+/** Set of fields depends on sample type from \ref pg_sample_format_event. Files without it have only
+ *  PERF_SAMPLE_IP and PERF_SAMPLE_CALLCHAIN enabled, see \ref createPerfEvent in \ref pgcollect.c */
 struct sample_event
 {
+  sample_event()
+    : ip(0)
+    , pid(0)
+    , tid(0)
+    , time(0)
+    , id(0)
+    , period(1)
+    , callchainSize(0)
+    , callchain(0)
+  {}
   __u64   ip;
+  __u32   pid;
+  __u32   tid;
+  __u64   time;
+  __u64   id;
+  __u64   period;
   __u64   callchainSize;
-  __u64   callchain[PERF_MAX_STACK_DEPTH];
+  const __u64* callchain;
+};
+
+/// Sample layout, see \ref pg_sample_format_event in \ref pgdata.h
+struct sample_format_event
+{
+  __u64 sampleType;
+  __s32 clockId;
+  __u32 reserved;
+};
+
+/// Event of sample id, see \ref pg_event_id_event in \ref pgdata.h
+struct event_id_event
+{
+  __u64 id;
+  __u32 index;
+  __u32 reserved;
+  char name[PG_EVENT_NAME_SIZE];
+};
+
+/// Chunk of vDSO image, see \ref pg_vdso_event in \ref pgdata.h
+struct vdso_event
+{
+  __u64 offset;
+  char data[PG_VDSO_CHUNK_SIZE];
 };
 
 struct perf_event
@@ -47,17 +105,70 @@ struct perf_event
   struct perf_event_header header;
   union {
     mmap_event mmap;
-    sample_event sample;
+    sample_format_event sampleFormat;
+    event_id_event eventId;
+    vdso_event vdso;
+    __u64 raw[USHRT_MAX / sizeof(__u64)];
   };
 };
 
 std::istream& operator>>(std::istream& is, perf_event& event)
 {
   is.read((char*)&event, sizeof(perf_event_header));
+  // Size includes header, smaller one means file is broken and the next record can't be found
+  if (is && event.header.size < sizeof(perf_event_header))
+  {
+    is.setstate(std::ios_base::failbit);
+    return is;
+  }
   is.read(((char*)&event) + sizeof(perf_event_header), event.header.size - sizeof(perf_event_header));
   return is;
 }
 
+/// Returns false if sample is truncated or has fields we can't skip
+bool parseSample(const perf_event& event, __u64 sampleType, sample_event& sample)
+{
+  const __u64* field = event.raw;
+  const __u64* end = field + (event.header.size - sizeof(perf_event_header)) / sizeof(__u64);
+
+  if (sampleType & PERF_SAMPLE_IDENTIFIER)
+    sample.id = *field++;
+  if (sampleType & PERF_SAMPLE_IP)
+    sample.ip = *field++;
+  if (sampleType & PERF_SAMPLE_TID)
+  {
+    const __u32* ids = (const __u32*)field++;
+    sample.pid = ids[0];
+    sample.tid = ids[1];
+  }
+  if (sampleType & PERF_SAMPLE_TIME)
+    sample.time = *field++;
+  if (sampleType & PERF_SAMPLE_ADDR)
+    field++;
+  if (sampleType & PERF_SAMPLE_ID)
+    sample.id = *field++;
+  if (sampleType & PERF_SAMPLE_STREAM_ID)
+    field++;
+  if (sampleType & PERF_SAMPLE_CPU)
+    field++;
+  if (sampleType & PERF_SAMPLE_PERIOD)
+    sample.period = *field++;
+  if (sampleType & PERF_SAMPLE_READ)
+    return false;
+  if (sampleType & PERF_SAMPLE_CALLCHAIN)
+  {
+    if (field >= end)
+      return false;
+    sample.callchainSize = *field++;
+    sample.callchain = field;
+    if (sample.callchainSize > __u64(end - field))
+      return false;
+    field += sample.callchainSize;
+  }
+
+  return field <= end;
+}
+
 }
 
 typedef std::tr1::unordered_set<std::string> StringTable;
@@ -70,20 +181,28 @@ class SymbolDataPrivate
   SymbolDataPrivate()
     : sourceFile_(&unknownFile)
     , sourceLine_(0)
+    , plt_(false)
   {}
   std::string name_;
+  /// Empty if it is the same as name
+  std::string linkageName_;
   const std::string* sourceFile_;
   size_t sourceLine_;
+  bool plt_;
 };
 
 // SymbolData methods
 
 const std::string& SymbolData::name() const { return d->name_; }
 
+const std::string& SymbolData::linkageName() const { return d->linkageName_.empty() ? d->name_ : d->linkageName_; }
+
 const std::string& SymbolData::sourceFile() const { return *d->sourceFile_; }
 
 size_t SymbolData::sourceLine() const { return d->sourceLine_; }
 
+bool SymbolData::isPlt() const { return d->plt_; }
+
 SymbolData::SymbolData()
   : d(new SymbolDataPrivate)
 {}
@@ -96,26 +215,28 @@ class EntryDataPrivate
 {
   friend class EntryData;
   friend class MemoryObjectDataPrivate;
-  explicit EntryDataPrivate(Count count)
-    : count_(count)
+  explicit EntryDataPrivate(const Costs& costs)
+    : costs_(costs)
     , sourceFile_(&unknownFile)
     , sourceLine_(0)
   {}
 
   void swap(EntryDataPrivate& other)
   {
-    std::swap(count_, other.count_);
+    std::swap(costs_, other.costs_);
     branches_.swap(other.branches_);
   }
 
-  Count count_;
+  Costs costs_;
   BranchStorage branches_;
   const std::string* sourceFile_;
   size_t sourceLine_;
 };
 
 // EntryData methods
-Count EntryData::count() const { return d->count_; }
+Count EntryData::count() const { return d->costs_.main(); }
+
+const Costs& EntryData::costs() const { return d->costs_; }
 
 const BranchStorage& EntryData::branches() const { return d->branches_; }
 
@@ -123,12 +244,21 @@ const std::string& EntryData::sourceFile() const { return *d->sourceFile_; }
 
 size_t EntryData::sourceLine() const { return d->sourceLine_; }
 
-EntryData::EntryData(Count count)
-  : d(new EntryDataPrivate(count))
+EntryData::EntryData(const Costs& costs)
+  : d(new EntryDataPrivate(costs))
 {}
 
 EntryData::~EntryData() { delete d; }
 
+/// Symbol and its only entry, which take costs and calls of folded symbols
+struct FoldTarget
+{
+  const Symbol* symbol;
+  EntryData* entry;
+  Address address;
+};
+typedef std::tr1::unordered_map<const Symbol*, FoldTarget> FoldTargets;
+
 // MemoryObjectDataPrivate methods
 
 class MemoryObjectDataPrivate
@@ -137,43 +267,58 @@ class MemoryObjectDataPrivate
   friend class ProfilePrivate;
   MemoryObjectDataPrivate(const char* fileName)
     : baseAddress_(0)
+    , fileOffset_(0)
     , fileName_(fileName)
+    , resolved_(false)
   {}
   ~MemoryObjectDataPrivate();
 
   void setBaseAddress(Address value) { baseAddress_ = value; }
-  EntryData &appendEntry(Address address, Count count);
-  void appendBranch(Address from, Address to);
+  EntryData &appendEntry(Address address, size_t event, Count count);
+  void appendBranch(Address from, Address to, size_t event, Count count);
 
   void resolveEntries(const AddressResolver& resolver, Address loadBase, StringTable* sourceFiles);
+  bool fixupEntry(Address address, EntryData& entryData, const MemoryObjectStorage& objects) const;
   void fixupBranches(const MemoryObjectStorage &objects);
+  void mergePending(const MemoryObjectStorage& objects);
+
+  void foldObjectEntries(ObjectFinder& finder, const std::tr1::unordered_set<const MemoryObjectData*>& folded,
+                         EntryData* otherEntry);
+  void foldSymbolEntries(const FoldTargets& folded);
+  void dropSymbols(const FoldTargets& folded);
 
   Address baseAddress_;
+  Size fileOffset_;
   EntryStorage entries_;
   SymbolStorage symbols_;
   std::string fileName_;
+
+  /// Entries of resolved object are fixed up, entries of samples loaded after that wait in pending ones
+  bool resolved_;
+  EntryStorage pending_;
 };
 
 MemoryObjectDataPrivate::~MemoryObjectDataPrivate()
 {
   for (EntryStorage::iterator entryIt = entries_.begin(); entryIt != entries_.end(); ++entryIt)
     delete entryIt->second;
+  for (EntryStorage::iterator entryIt = pending_.begin(); entryIt != pending_.end(); ++entryIt)
+    delete entryIt->second;
 }
 
-EntryData& MemoryObjectDataPrivate::appendEntry(Address address, Count count)
+EntryData& MemoryObjectDataPrivate::appendEntry(Address address, size_t event, Count count)
 {
-  EntryData*& entryData = entries_[address];
+  EntryData*& entryData = (resolved_ ? pending_ : entries_)[address];
   if (!entryData)
-    entryData = new EntryData(count);
-  else
-    entryData->d->count_ += count;
+    entryData = new EntryData(Costs());
+  entryData->d->costs_.add(event, count);
 
   return *entryData;
 }
 
-void MemoryObjectDataPrivate::appendBranch(Address from, Address to)
+void MemoryObjectDataPrivate::appendBranch(Address from, Address to, size_t event, Count count)
 {
-  appendEntry(from, 0).d->branches_[to]++;
+  appendEntry(from, event, 0).d->branches_[to].add(event, count);
 }
 
 void MemoryObjectDataPrivate::resolveEntries(const AddressResolver &resolver, Address loadBase,
@@ -181,37 +326,52 @@ void MemoryObjectDataPrivate::resolveEntries(const AddressResolver &resolver, Ad
 {
   // Set up correct base address
   baseAddress_ = resolver.baseAddress();
+  // Resolved object gets only pending entries resolved, symbols and source positions known already are reused
+  EntryStorage& entries = resolved_ ? pending_ : entries_;
   // Perform resolving
-  EntryStorage::iterator entryIt = entries_.begin();
-  while (entryIt != entries_.end())
+  EntryStorage::iterator entryIt = entries.begin();
+  while (entryIt != entries.end())
   {
     Range symbolRange;
-    SymbolData* symbolData = new SymbolData();
-
-    if (resolver.resolve(entryIt->first, loadBase, symbolRange, symbolData->d->name_))
+    SymbolStorage::const_iterator symIt = resolved_ ? symbols_.find(Range(entryIt->first)) : symbols_.end();
+    if (symIt != symbols_.end())
+      symbolRange = symIt->first;
+    else
     {
-      if (sourceFiles)
+      SymbolData* symbolData = new SymbolData();
+
+      if (resolver.resolve(entryIt->first, loadBase, symbolRange, symbolData->d->name_,
+                           &symbolData->d->linkageName_, &symbolData->d->plt_))
       {
-        const std::pair<const char*, size_t>& pos = resolver.getSourcePosition(symbolRange.start, loadBase);
-        if (pos.first)
+        if (sourceFiles)
         {
-          symbolData->d->sourceFile_ = &(*sourceFiles->insert(pos.first).first);
-          symbolData->d->sourceLine_ = pos.second;
+          const std::pair<const char*, size_t>& pos = resolver.getSourcePosition(symbolRange.start, loadBase);
+          if (pos.first)
+          {
+            symbolData->d->sourceFile_ = &(*sourceFiles->insert(pos.first).first);
+            symbolData->d->sourceLine_ = pos.second;
+          }
         }
+        symbols_.insert(Symbol(symbolRange, symbolData));
+      }
+      else
+      {
+        delete symbolData;
+        delete entryIt->second;
+        entries.erase(entryIt++);
+        continue;
       }
-      symbols_.insert(Symbol(symbolRange, symbolData));
-    }
-    else
-    {
-      delete symbolData;
-      delete entryIt->second;
-      entries_.erase(entryIt++);
-      continue;
     }
 
     do
     {
-      if (sourceFiles)
+      EntryStorage::const_iterator knownIt = resolved_ ? entries_.find(entryIt->first) : entries_.end();
+      if (knownIt != entries_.end())
+      {
+        entryIt->second->d->sourceFile_ = knownIt->second->d->sourceFile_;
+        entryIt->second->d->sourceLine_ = knownIt->second->d->sourceLine_;
+      }
+      else if (sourceFiles)
       {
         const std::pair<const char*, size_t>& pos = resolver.getSourcePosition(entryIt->first, loadBase);
         if (pos.first)
@@ -222,8 +382,38 @@ void MemoryObjectDataPrivate::resolveEntries(const AddressResolver &resolver, Ad
       }
       ++entryIt;
     }
-    while (entryIt != entries_.end() && entryIt->first < symbolRange.end);
+    while (entryIt != entries.end() && entryIt->first < symbolRange.end);
+  }
+}
+
+/// Call "to" addresses are replaced by symbols, returns false if nothing is left in entry
+bool MemoryObjectDataPrivate::fixupEntry(Address address, EntryData& entryData,
+                                         const MemoryObjectStorage& objects) const
+{
+  if (entryData.branches().size() == 0)
+    return true;
+
+  // Must exist, we drop unresolved entries earlier
+  SymbolStorage::const_iterator selfSymIt = symbols_.find(Range(address));
+
+  EntryData fixedEntry(entryData.costs());
+  for (BranchStorage::const_iterator branchIt = entryData.branches().begin(); branchIt != entryData.branches().end();
+       ++branchIt)
+  {
+    const Address& branchAddress = branchIt->first.address;
+    const MemoryObjectData* callObjectData = objects.at(Range(branchAddress));
+    SymbolStorage::const_iterator callSymbolIt = callObjectData->d->symbols_.find(Range(branchAddress));
+    if (callSymbolIt != callObjectData->symbols().end())
+    {
+      if (callObjectData->d != this || callSymbolIt != selfSymIt)
+        fixedEntry.d->branches_[&(*callSymbolIt)] += branchIt->second;
+    }
   }
+
+  if (fixedEntry.branches().size() == 0 && entryData.costs().empty())
+    return false;
+  entryData.d->swap(*fixedEntry.d);
+  return true;
 }
 
 void MemoryObjectDataPrivate::fixupBranches(const MemoryObjectStorage& objects)
@@ -234,40 +424,122 @@ void MemoryObjectDataPrivate::fixupBranches(const MemoryObjectStorage& objects)
   EntryStorage::iterator entryIt = entries_.begin();
   while (entryIt != entries_.end())
   {
-    EntryData& entryData = *(entryIt->second);
-    if (entryData.branches().size() == 0)
-    {
+    if (fixupEntry(entryIt->first, *entryIt->second, objects))
       ++entryIt;
+    else
+    {
+      delete entryIt->second;
+      entries_.erase(entryIt++);
+    }
+  }
+}
+
+/// Pending entries are fixed up and added to entries of resolved object
+void MemoryObjectDataPrivate::mergePending(const MemoryObjectStorage& objects)
+{
+  for (EntryStorage::iterator entryIt = pending_.begin(); entryIt != pending_.end(); ++entryIt)
+  {
+    EntryData* pending = entryIt->second;
+    if (!fixupEntry(entryIt->first, *pending, objects))
+    {
+      delete pending;
       continue;
     }
 
-    // Must exist, we drop unresolved entries earlier
-    SymbolStorage::const_iterator selfSymIt = symbols_.find(Range(entryIt->first));
+    std::pair<EntryStorage::iterator, bool> insResult = entries_.insert(Entry(entryIt->first, pending));
+    if (insResult.second)
+      continue;
+    EntryData& entry = *insResult.first->second;
+    entry.d->costs_ += pending->d->costs_;
+    for (BranchStorage::const_iterator branchIt = pending->d->branches_.begin();
+         branchIt != pending->d->branches_.end(); ++branchIt)
+      entry.d->branches_[branchIt->first] += branchIt->second;
+    delete pending;
+  }
+  pending_.clear();
+}
 
-    EntryData fixedEntry(entryData.count());
-    for (BranchStorage::const_iterator branchIt = entryData.branches().begin(); branchIt != entryData.branches().end();
+/// Calls are still kept by address, so calls into folded objects are redirected to "[other]" address
+/** Entries of folded object, which has non-null otherEntry, are all added to it. */
+void MemoryObjectDataPrivate::foldObjectEntries(ObjectFinder& finder,
+                                                const std::tr1::unordered_set<const MemoryObjectData*>& folded,
+                                                EntryData* otherEntry)
+{
+  for (EntryStorage::iterator entryIt = entries_.begin(); entryIt != entries_.end(); ++entryIt)
+  {
+    EntryData& entry = *entryIt->second;
+    if (otherEntry)
+      otherEntry->d->costs_ += entry.d->costs_;
+    BranchStorage branches;
+    for (BranchStorage::const_iterator branchIt = entry.d->branches_.begin(); branchIt != entry.d->branches_.end();
          ++branchIt)
     {
-      const Address& branchAddress = branchIt->first.address;
-      const MemoryObjectData* callObjectData = objects.at(Range(branchAddress));
-      SymbolStorage::const_iterator callSymbolIt = callObjectData->d->symbols_.find(Range(branchAddress));
-      if (callSymbolIt != callObjectData->symbols().end())
-      {
-        if (callObjectData->d != this || callSymbolIt != selfSymIt)
-          fixedEntry.d->branches_[&(*callSymbolIt)] += branchIt->second;
-      }
+      const MemoryObject* callObject = finder.find(branchIt->first.address);
+      Address to = callObject && folded.count(callObject->second) ? otherAddress : branchIt->first.address;
+      (otherEntry ? otherEntry->d->branches_ : branches)[to] += branchIt->second;
     }
+    if (!otherEntry)
+      entry.d->branches_.swap(branches);
+  }
+}
 
-    if (fixedEntry.branches().size() != 0 || entryData.count() != 0)
+/// Entries of folded symbols are added to entries of their targets, calls to folded symbols become calls to targets
+void MemoryObjectDataPrivate::foldSymbolEntries(const FoldTargets& folded)
+{
+  SymbolStorage::const_iterator symIt = symbols_.end();
+  const Symbol* self = 0;
+  EntryData* target = 0;
+  EntryStorage::iterator entryIt = entries_.begin();
+  while (entryIt != entries_.end())
+  {
+    // Must exist, we drop unresolved entries earlier
+    if (symIt == symbols_.end() || entryIt->first >= symIt->first.end)
     {
-      entryData.d->swap(*fixedEntry.d);
-      ++entryIt;
+      symIt = symbols_.find(Range(entryIt->first));
+      FoldTargets::const_iterator targetIt = folded.find(&*symIt);
+      self = targetIt != folded.end() ? targetIt->second.symbol : &*symIt;
+      target = targetIt != folded.end() ? targetIt->second.entry : 0;
     }
-    else
+
+    EntryData& entry = *entryIt->second;
+    bool fold = target && &entry != target;
+    BranchStorage branches;
+    for (BranchStorage::const_iterator branchIt = entry.d->branches_.begin(); branchIt != entry.d->branches_.end();
+         ++branchIt)
     {
+      FoldTargets::const_iterator targetIt = folded.find(branchIt->first.symbol);
+      const Symbol* callSymbol = targetIt != folded.end() ? targetIt->second.symbol : branchIt->first.symbol;
+      if (callSymbol != self)
+        (fold ? target->d->branches_ : branches)[callSymbol] += branchIt->second;
+    }
+
+    if (fold)
+    {
+      target->d->costs_ += entry.d->costs_;
       delete entryIt->second;
       entries_.erase(entryIt++);
     }
+    else
+    {
+      entry.d->branches_.swap(branches);
+      ++entryIt;
+    }
+  }
+}
+
+void MemoryObjectDataPrivate::dropSymbols(const FoldTargets& folded)
+{
+  SymbolStorage::iterator symIt = symbols_.begin();
+  while (symIt != symbols_.end())
+  {
+    FoldTargets::const_iterator targetIt = folded.find(&*symIt);
+    if (targetIt != folded.end() && targetIt->second.symbol != &*symIt)
+    {
+      delete symIt->second;
+      symbols_.erase(symIt++);
+    }
+    else
+      ++symIt;
   }
 }
 
@@ -277,6 +549,8 @@ Address MemoryObjectData::baseAddress() const { return d->baseAddress_; }
 
 const std::string& MemoryObjectData::fileName() const { return d->fileName_; }
 
+Size MemoryObjectData::fileOffset() const { return d->fileOffset_; }
+
 const EntryStorage& MemoryObjectData::entries() const { return d->entries_; }
 
 const SymbolStorage& MemoryObjectData::symbols() const { return d->symbols_; }
@@ -292,39 +566,218 @@ class ProfilePrivate
 {
   friend class Profile;
   ProfilePrivate()
-    : mmapEventCount_(0)
+    : sampleType_(PERF_SAMPLE_IP | PERF_SAMPLE_CALLCHAIN)
+    , clockId_(-1)
+    , jitDirectory_("/tmp")
+    , jitObject_(0)
+    , otherObject_(0)
+    , details_(Profile::Sources)
+    , resolved_(false)
+    , keepStacks_(false)
+    , keepSamples_(false)
+    , dedupCallSites_(false)
+    , follow_(false)
+    , mode_(Profile::CallGraph)
+    , readOffset_(0)
+    , mmapEventCount_(0)
     , goodSamplesCount_(0)
     , badSamplesCount_(0)
-  {}
+    , badRecordsCount_(0)
+  {
+    events_.push_back("Cycles");
+  }
   ~ProfilePrivate();
 
+  size_t read(std::istream& is);
+  MemoryObjectStorage::iterator findObject(Address address);
+
   void processMmapEvent(const pe::mmap_event &event);
   void processSampleEvent(const pe::sample_event &event, Profile::Mode mode);
+  void processSampleFormatEvent(const pe::sample_format_event &event);
+  void processEventIdEvent(const pe::event_id_event &event);
+  bool processVdsoEvent(const pe::vdso_event &event, size_t dataSize);
+
+  void loadJitFiles(__u32 pid);
+  void loadJitDump(const std::string& fileName);
+  void ensureJitObject();
+  /// JIT code loads are timed with CLOCK_MONOTONIC, without the same clock for samples the latest code wins
+  Address translateJitAddress(const pe::sample_event& event, Address address) const
+  {
+    if (!jitObject_)
+      return address;
+    bool haveTime = (sampleType_ & PERF_SAMPLE_TIME) && clockId_ == CLOCK_MONOTONIC;
+    return jitCode_.translate(event.pid, address, haveTime ? event.time : ULLONG_MAX);
+  }
 
   void cleanupMemoryObjects();
+  std::string writeVdsoImage() const;
   void resolveAndFixup(Profile::DetailLevel details);
 
+  MemoryObjectData* ensureOtherObject();
+  void resolveOtherObject();
+  template <class Replacement> void foldStackFrames(const Replacement& replace);
+  void foldObjects(const std::vector<const MemoryObjectData*>& objects);
+  void foldSymbols(const std::tr1::unordered_set<const Symbol*>& symbols);
+  void foldSymbols(const FoldTargets& folded);
+  void collapseCycles(const std::vector<std::vector<const Symbol*> >& cycles);
+
   MemoryObjectStorage memoryObjects_;
   StringTable sourceFiles_;
+  std::string vdsoImage_;
+
+  __u64 sampleType_;
+  __s32 clockId_;
+  std::vector<std::string> events_;
+  /// Event indexes by sample ids
+  std::map<__u64, size_t> eventIds_;
+
+  std::string jitDirectory_;
+  JitCodeMap jitCode_;
+  MemoryObjectData* jitObject_;
+  std::set<__u32> jitPids_;
+  std::set<std::string> jitDumps_;
+
+  /// Costs of folded objects and symbols, see \ref Profile::foldObjects and \ref Profile::foldSymbols
+  MemoryObjectData* otherObject_;
+  Profile::DetailLevel details_;
+  bool resolved_;
+
+  void addStack(const Stack& stack, const pe::sample_event& event, Count cost);
+
+  bool keepStacks_;
+  bool keepSamples_;
+  StackStorage stacks_;
+  SampleStorage samples_;
+
+  bool dedupCallSites_;
+  /// Call sites of current sample, kept between samples to save allocations
+  std::tr1::unordered_set<Address> callSites_;
+
+  /// See \ref Profile::update
+  bool follow_;
+  Profile::Mode mode_;
+  /// End of the last complete record
+  std::streamoff readOffset_;
+  /// Objects without samples are kept aside while following, as samples could come for them later
+  MemoryObjectStorage idleObjects_;
+  /// Resolvers of objects are kept while following, so only new addresses are resolved later
+  std::tr1::unordered_map<const MemoryObjectData*, AddressResolver*> resolvers_;
 
   size_t mmapEventCount_;
   size_t goodSamplesCount_;
   size_t badSamplesCount_;
+  /// Records other than samples, which are too short or describe impossible data
+  size_t badRecordsCount_;
 };
 
 ProfilePrivate::~ProfilePrivate()
 {
   for (MemoryObjectStorage::iterator objIt = memoryObjects_.begin(); objIt != memoryObjects_.end(); ++objIt)
     delete objIt->second;
+  for (MemoryObjectStorage::iterator objIt = idleObjects_.begin(); objIt != idleObjects_.end(); ++objIt)
+    delete objIt->second;
+  for (std::tr1::unordered_map<const MemoryObjectData*, AddressResolver*>::iterator resolverIt = resolvers_.begin();
+       resolverIt != resolvers_.end(); ++resolverIt)
+    delete resolverIt->second;
+}
+
+size_t ProfilePrivate::read(std::istream& is)
+{
+  size_t records = 0;
+  pe::perf_event event;
+  while (!is.eof() && !is.fail())
+  {
+    is >> event;
+    if (is.eof() || is.fail())
+      break;
+    records++;
+    readOffset_ += event.header.size;
+    switch (event.header.type)
+    {
+    case PERF_RECORD_MMAP:
+      processMmapEvent(event.mmap);
+      break;
+    case PERF_RECORD_SAMPLE: {
+      pe::sample_event sample;
+      if (pe::parseSample(event, sampleType_, sample))
+        processSampleEvent(sample, mode_);
+      else
+        badSamplesCount_++;
+      break;
+    }
+    case PG_RECORD_SAMPLE_FORMAT:
+      if (event.header.size < sizeof(event.header) + sizeof(event.sampleFormat))
+        badRecordsCount_++;
+      else
+        processSampleFormatEvent(event.sampleFormat);
+      break;
+    case PG_RECORD_EVENT_ID:
+      if (event.header.size < sizeof(event.header) + sizeof(event.eventId) || event.eventId.index >= PG_MAX_EVENTS)
+        badRecordsCount_++;
+      else
+        processEventIdEvent(event.eventId);
+      break;
+    case PG_RECORD_VDSO:
+      if (event.header.size < sizeof(event.header) + sizeof(event.vdso.offset) ||
+          !processVdsoEvent(event.vdso, event.header.size - sizeof(event.header) - sizeof(event.vdso.offset)))
+        badRecordsCount_++;
+    }
+  }
+
+  if (follow_)
+  {
+    // Record being written now is read by the next update
+    is.clear();
+    is.seekg(readOffset_);
+  }
+  cleanupMemoryObjects();
+  return records;
+}
+
+MemoryObjectStorage::iterator ProfilePrivate::findObject(Address address)
+{
+  MemoryObjectStorage::iterator objIt = memoryObjects_.find(Range(address));
+  if (objIt != memoryObjects_.end() || idleObjects_.empty())
+    return objIt;
+
+  MemoryObjectStorage::iterator idleIt = idleObjects_.find(Range(address));
+  if (idleIt == idleObjects_.end())
+    return objIt;
+  // Object got its first samples, unless another one was mapped over it meanwhile
+  std::pair<MemoryObjectStorage::iterator, bool> insResult = memoryObjects_.insert(*idleIt);
+  if (!insResult.second)
+  {
+    if (idleIt->second == jitObject_)
+      jitObject_ = 0;
+    std::tr1::unordered_map<const MemoryObjectData*, AddressResolver*>::iterator resolverIt =
+        resolvers_.find(idleIt->second);
+    if (resolverIt != resolvers_.end())
+    {
+      delete resolverIt->second;
+      resolvers_.erase(resolverIt);
+    }
+    delete idleIt->second;
+  }
+  idleObjects_.erase(idleIt);
+  return insResult.first;
 }
 
 void ProfilePrivate::processMmapEvent(const pe::mmap_event &event)
 {
+  loadJitFiles(event.pid);
+
+  // JIT compilers mmap their jitdump files, so we could find them
+  const char* baseName = basename(event.fileName);
+  size_t baseNameLength = strlen(baseName);
+  if (strncmp(baseName, "jit-", 4) == 0 && baseNameLength > 9 && strcmp(baseName + baseNameLength - 5, ".dump") == 0)
+    loadJitDump(event.fileName);
+
+  MemoryObjectData* objectData = new MemoryObjectData(event.fileName);
+  objectData->d->fileOffset_ = event.pageOffset;
 #ifndef NDEBUG
   std::pair<MemoryObjectStorage::const_iterator, bool> insRes =
 #endif
-  memoryObjects_.insert(MemoryObject(Range(event.address, event.address + event.length),
-                                    new MemoryObjectData(event.fileName)));
+  memoryObjects_.insert(MemoryObject(Range(event.address, event.address + event.length), objectData));
 #ifndef NDEBUG
   if (!insRes.second)
   {
@@ -342,27 +795,55 @@ void ProfilePrivate::processMmapEvent(const pe::mmap_event &event)
 
 void ProfilePrivate::processSampleEvent(const pe::sample_event &event, Profile::Mode mode)
 {
-  if (event.callchain[0] != PERF_CONTEXT_USER || event.callchainSize < 2 || event.callchainSize > PERF_MAX_STACK_DEPTH)
+  if (event.callchainSize < 2 || event.callchainSize > PERF_MAX_STACK_DEPTH || event.callchain[0] != PERF_CONTEXT_USER)
   {
     badSamplesCount_++;
     return;
   }
 
-  MemoryObjectStorage::iterator objIt = memoryObjects_.find(Range(event.ip));
+  if (sampleType_ & PERF_SAMPLE_TID)
+    loadJitFiles(event.pid);
+
+  Address ip = translateJitAddress(event, event.ip);
+  MemoryObjectStorage::iterator objIt = findObject(ip);
   if (objIt == memoryObjects_.end())
   {
     badSamplesCount_++;
     return;
   }
 
-  objIt->second->d->appendEntry(event.ip, 1);
+  // Files with several events have periods, so costs of events could be compared
+  size_t eventIndex = 0;
+  if (!eventIds_.empty())
+  {
+    std::map<__u64, size_t>::const_iterator idIt = eventIds_.find(event.id);
+    if (idIt == eventIds_.end())
+    {
+      badSamplesCount_++;
+      return;
+    }
+    eventIndex = idIt->second;
+  }
+  Count cost = (sampleType_ & PERF_SAMPLE_PERIOD) ? event.period : 1;
+
+  objIt->second->d->appendEntry(ip, eventIndex, cost);
   goodSamplesCount_++;
 
+  bool keepStack = keepStacks_ && eventIndex == 0;
+  Stack stack;
+  if (keepStack)
+    stack.push_back(ip);
+
   if (mode != Profile::CallGraph)
+  {
+    if (keepStack)
+      addStack(stack, event, cost);
     return;
+  }
 
   bool skipFrame = false;
-  Address callTo = event.ip;
+  Address callTo = ip;
+  callSites_.clear();
 
   for (__u64 i = 2; i < event.callchainSize; ++i)
   {
@@ -373,17 +854,101 @@ void ProfilePrivate::processSampleEvent(const pe::sample_event &event, Profile::
       skipFrame = (callFrom != PERF_CONTEXT_USER);
       continue;
     }
-    if (skipFrame || callFrom == callTo)
+    callFrom = translateJitAddress(event, callFrom);
+    if (skipFrame)
       continue;
 
-    objIt = memoryObjects_.find(Range(callFrom));
+    objIt = findObject(callFrom);
     if (objIt == memoryObjects_.end())
       continue;
+    // Direct recursion repeats the same return address, stacks keep every frame of it
+    if (keepStack)
+      stack.push_back(callFrom);
 
-    objIt->second->d->appendBranch(callFrom, callTo);
+    // Recursion repeats the same call sites in stack, sample is counted once for each of them. Call site next to
+    // the same one is a call of function to itself, it is never counted twice.
+    bool repeated = dedupCallSites_ && !callSites_.insert(callFrom).second;
+    if (callFrom != callTo && !repeated)
+      objIt->second->d->appendBranch(callFrom, callTo, eventIndex, cost);
 
     callTo = callFrom;
   }
+
+  if (keepStack)
+    addStack(stack, event, cost);
+}
+
+void ProfilePrivate::addStack(const Stack& stack, const pe::sample_event& event, Count cost)
+{
+  StackStorage::iterator stackIt = stacks_.insert(StackStorage::value_type(stack, 0)).first;
+  stackIt->second += cost;
+  if (keepSamples_)
+  {
+    TimedSample sample = { event.time, event.pid, event.tid, &stackIt->first };
+    samples_.push_back(sample);
+  }
+}
+
+void ProfilePrivate::processSampleFormatEvent(const pe::sample_format_event &event)
+{
+  sampleType_ = event.sampleType;
+  clockId_ = event.clockId;
+}
+
+void ProfilePrivate::processEventIdEvent(const pe::event_id_event &event)
+{
+  if (events_.size() <= event.index)
+    events_.resize(event.index + 1);
+  events_[event.index].assign(event.name, strnlen(event.name, sizeof(event.name)));
+  eventIds_[event.id] = event.index;
+}
+
+void ProfilePrivate::loadJitFiles(__u32 pid)
+{
+  if (pid == 0 || !jitPids_.insert(pid).second)
+    return;
+
+  std::stringstream perfMapName;
+  perfMapName << jitDirectory_ << "/perf-" << pid << ".map";
+  jitCode_.loadPerfMap(perfMapName.str(), pid);
+
+  std::stringstream jitDumpName;
+  jitDumpName << jitDirectory_ << "/jit-" << pid << ".dump";
+  loadJitDump(jitDumpName.str());
+
+  ensureJitObject();
+}
+
+void ProfilePrivate::loadJitDump(const std::string& fileName)
+{
+  if (!jitDumps_.insert(fileName).second)
+    return;
+  // File could be copied from profiled host into JIT directory
+  if (!jitCode_.loadJitDump(fileName))
+    jitCode_.loadJitDump(jitDirectory_ + '/' + basename(fileName.c_str()));
+  ensureJitObject();
+}
+
+void ProfilePrivate::ensureJitObject()
+{
+  if (jitObject_ || jitCode_.empty())
+    return;
+
+  // All JIT code lives in one synthetic object, see JitCodeMap
+  jitObject_ = new MemoryObjectData("[jit]");
+  memoryObjects_.insert(MemoryObject(Range(JitCodeMap::syntheticBase,
+                                           JitCodeMap::syntheticBase + JitCodeMap::syntheticSize), jitObject_));
+}
+
+bool ProfilePrivate::processVdsoEvent(const pe::vdso_event &event, size_t dataSize)
+{
+  // vDSO is a couple of pages, offset far beyond it comes from broken file and would allocate anything
+  if (event.offset > maxVdsoSize || dataSize > maxVdsoSize - event.offset)
+    return false;
+  if (vdsoImage_.size() < event.offset + dataSize)
+    vdsoImage_.resize(event.offset + dataSize);
+  vdsoImage_.replace(event.offset, dataSize, event.data, dataSize);
+  return true;
 }
 
 void ProfilePrivate::cleanupMemoryObjects()
@@ -392,8 +957,18 @@ void ProfilePrivate::cleanupMemoryObjects()
   MemoryObjectStorage::iterator objIt = memoryObjects_.begin();
   while (objIt != memoryObjects_.end())
   {
-    if (objIt->second->entries().size() == 0)
+    if (objIt->second->entries().size() == 0 && objIt->second->d->pending_.empty())
     {
+      if (follow_ && objIt->second != otherObject_)
+      {
+        idleObjects_.insert(*objIt);
+        memoryObjects_.erase(objIt++);
+        continue;
+      }
+      if (objIt->second == jitObject_)
+        jitObject_ = 0;
+      if (objIt->second == otherObject_)
+        otherObject_ = 0;
       delete objIt->second;
       // With C++11 we can just do:
       // objIt = d->memoryObjects.erase(objIt);
@@ -404,15 +979,279 @@ void ProfilePrivate::cleanupMemoryObjects()
   }
 }
 
+std::string ProfilePrivate::writeVdsoImage() const
+{
+  // Resolver needs a file, so put image into temporary directory under its original name
+  const char* tmpDir = getenv("TMPDIR");
+  std::string fileName(tmpDir ? tmpDir : "/tmp");
+  fileName.append("/pgconvert.XXXXXX");
+  if (!mkdtemp(&fileName[0]))
+    return std::string();
+  fileName.append("/[vdso]");
+
+  FILE* file = fopen(fileName.c_str(), "w");
+  if (!file)
+    return std::string();
+  bool ok = fwrite(vdsoImage_.data(), vdsoImage_.size(), 1, file) == 1;
+  ok = (fclose(file) == 0) && ok;
+  if (!ok)
+  {
+    unlink(fileName.c_str());
+    return std::string();
+  }
+  return fileName;
+}
+
 void ProfilePrivate::resolveAndFixup(Profile::DetailLevel details)
 {
+  details_ = details;
+
+  // Objects resolved before keep their resolvers while following, the rest get new ones
+  std::string vdsoFileName;
+  std::vector<std::string> fileNames;
+  for (MemoryObjectStorage::const_iterator objIt = memoryObjects_.begin(); objIt != memoryObjects_.end(); ++objIt)
+  {
+    if (objIt->second == jitObject_ || objIt->second == otherObject_ || resolvers_.count(objIt->second))
+      continue;
+    const std::string& fileName = objIt->second->fileName();
+    if (fileName == "[vdso]" && !vdsoImage_.empty() && vdsoFileName.empty())
+      vdsoFileName = writeVdsoImage();
+    fileNames.push_back(fileName == "[vdso]" && !vdsoFileName.empty() ? vdsoFileName : fileName);
+  }
+  AddressResolver::prefetchDebugInfo(details, fileNames);
+
+  std::vector<std::string>::const_iterator fileNameIt = fileNames.begin();
+  for (MemoryObjectStorage::iterator objIt = memoryObjects_.begin(); objIt != memoryObjects_.end(); ++objIt)
+  {
+    if (objIt->second == jitObject_)
+    {
+      AddressResolver r(details, "[jit]", objIt->first.end - objIt->first.start, jitCode_.symbols());
+      objIt->second->d->resolveEntries(r, objIt->first.start, 0);
+    }
+    else if (objIt->second == otherObject_)
+      resolveOtherObject();
+    else
+    {
+      AddressResolver*& resolver = resolvers_[objIt->second];
+      if (!resolver)
+        resolver = new AddressResolver(details, (fileNameIt++)->c_str(), objIt->first.end - objIt->first.start);
+      objIt->second->d->resolveEntries(*resolver, objIt->first.start,
+                                       details == Profile::Sources? &sourceFiles_ : 0);
+      if (!follow_)
+      {
+        delete resolver;
+        resolvers_.erase(objIt->second);
+      }
+    }
+  }
+
+  if (!vdsoFileName.empty())
+  {
+    unlink(vdsoFileName.c_str());
+    rmdir(vdsoFileName.substr(0, vdsoFileName.rfind('/')).c_str());
+  }
+  for (MemoryObjectStorage::iterator objIt = memoryObjects_.begin(); objIt != memoryObjects_.end(); ++objIt)
+  {
+    MemoryObjectDataPrivate* object = objIt->second->d;
+    if (object->resolved_)
+      object->mergePending(memoryObjects_);
+    else
+      object->fixupBranches(memoryObjects_);
+  }
+  // Samples loaded later wait for the next call in pending entries
+  if (follow_)
+    for (MemoryObjectStorage::iterator objIt = memoryObjects_.begin(); objIt != memoryObjects_.end(); ++objIt)
+      objIt->second->d->resolved_ = true;
+  resolved_ = true;
+}
+
+MemoryObjectData* ProfilePrivate::ensureOtherObject()
+{
+  if (otherObject_)
+    return otherObject_;
+
+  // The only entry collects all folded costs
+  otherObject_ = new MemoryObjectData("[other]");
+  memoryObjects_.insert(MemoryObject(Range(otherAddress, otherAddress + otherSize), otherObject_));
+  otherObject_->d->appendEntry(otherAddress, 0, 0);
+  if (resolved_)
+    resolveOtherObject();
+  return otherObject_;
+}
+
+void ProfilePrivate::resolveOtherObject()
+{
+  std::map<Range, std::string> symbols;
+  symbols[Range(0, otherSize)] = "[other]";
+  AddressResolver r(details_, "[other]", otherSize, symbols);
+  otherObject_->d->resolveEntries(r, otherAddress, 0);
+}
+
+/// Frames of folded objects or symbols are replaced by address of their target, calls within it are dropped
+template <class Replacement>
+void ProfilePrivate::foldStackFrames(const Replacement& replace)
+{
+  StackStorage stacks;
+  std::tr1::unordered_map<const Stack*, const Stack*> newStacks;
+  Stack stack;
+  for (StackStorage::const_iterator stackIt = stacks_.begin(); stackIt != stacks_.end(); ++stackIt)
+  {
+    stack.clear();
+    for (Stack::const_iterator frameIt = stackIt->first.begin(); frameIt != stackIt->first.end(); ++frameIt)
+    {
+      Address address = replace(*frameIt);
+      if (address == *frameIt || stack.empty() || stack.back() != address)
+        stack.push_back(address);
+    }
+    StackStorage::iterator newStackIt = stacks.insert(StackStorage::value_type(stack, 0)).first;
+    newStackIt->second += stackIt->second;
+    newStacks[&stackIt->first] = &newStackIt->first;
+  }
+
+  for (SampleStorage::iterator sampleIt = samples_.begin(); sampleIt != samples_.end(); ++sampleIt)
+    sampleIt->stack = newStacks[sampleIt->stack];
+  // Nodes are swapped, so pointers to new stacks stay valid
+  stacks_.swap(stacks);
+}
+
+namespace {
+
+struct FoldedObjectFrame
+{
+  FoldedObjectFrame(ObjectFinder& _finder, const std::tr1::unordered_set<const MemoryObjectData*>& _objects)
+    : finder(_finder)
+    , objects(_objects)
+  {}
+  Address operator()(Address address) const
+  {
+    const MemoryObject* object = finder.find(address);
+    return object && objects.count(object->second) ? otherAddress : address;
+  }
+  ObjectFinder& finder;
+  const std::tr1::unordered_set<const MemoryObjectData*>& objects;
+};
+
+struct FoldedSymbolFrame
+{
+  FoldedSymbolFrame(ObjectFinder& _finder, const FoldTargets& _folded)
+    : finder(_finder)
+    , folded(_folded)
+  {}
+  Address operator()(Address address) const
+  {
+    const MemoryObject* object = finder.find(address);
+    if (!object)
+      return address;
+    SymbolStorage::const_iterator symIt = object->second->symbols().find(Range(address));
+    if (symIt == object->second->symbols().end())
+      return address;
+    FoldTargets::const_iterator targetIt = folded.find(&*symIt);
+    return targetIt != folded.end() ? targetIt->second.address : address;
+  }
+  ObjectFinder& finder;
+  const FoldTargets& folded;
+};
+
+}
+
+void ProfilePrivate::foldObjects(const std::vector<const MemoryObjectData*>& objects)
+{
+  if (objects.empty())
+    return;
+
+  std::tr1::unordered_set<const MemoryObjectData*> folded(objects.begin(), objects.end());
+  EntryData& otherEntry = *ensureOtherObject()->d->entries_.begin()->second;
+  folded.erase(otherObject_);
+
+  ObjectFinder finder(memoryObjects_);
   for (MemoryObjectStorage::iterator objIt = memoryObjects_.begin(); objIt != memoryObjects_.end(); ++objIt)
+    objIt->second->d->foldObjectEntries(finder, folded, folded.count(objIt->second) ? &otherEntry : 0);
+
+  foldStackFrames(FoldedObjectFrame(finder, folded));
+
+  MemoryObjectStorage::iterator objIt = memoryObjects_.begin();
+  while (objIt != memoryObjects_.end())
   {
-      AddressResolver r(details, objIt->second->d->fileName_.c_str(), objIt->first.end - objIt->first.start);
-      objIt->second->d->resolveEntries(r, objIt->first.start, details == Profile::Sources? &sourceFiles_ : 0);
+    if (folded.count(objIt->second))
+    {
+      if (objIt->second == jitObject_)
+        jitObject_ = 0;
+      delete objIt->second;
+      memoryObjects_.erase(objIt++);
+    }
+    else
+      ++objIt;
   }
+}
+
+void ProfilePrivate::foldSymbols(const std::tr1::unordered_set<const Symbol*>& symbols)
+{
+  if (symbols.empty())
+    return;
+
+  MemoryObjectData* otherObject = ensureOtherObject();
+  FoldTarget other = { &*otherObject->d->symbols_.begin(), otherObject->d->entries_.begin()->second, otherAddress };
+  FoldTargets folded;
+  for (std::tr1::unordered_set<const Symbol*>::const_iterator symIt = symbols.begin(); symIt != symbols.end(); ++symIt)
+    folded[*symIt] = other;
+  foldSymbols(folded);
+}
+
+void ProfilePrivate::foldSymbols(const FoldTargets& folded)
+{
+  // Symbols are needed to find folded frames, so stacks go first
+  ObjectFinder finder(memoryObjects_);
+  foldStackFrames(FoldedSymbolFrame(finder, folded));
+
+  // Symbols are deleted only when calls to them are redirected everywhere
   for (MemoryObjectStorage::iterator objIt = memoryObjects_.begin(); objIt != memoryObjects_.end(); ++objIt)
-    objIt->second->d->fixupBranches(memoryObjects_);
+    objIt->second->d->foldSymbolEntries(folded);
+  for (MemoryObjectStorage::iterator objIt = memoryObjects_.begin(); objIt != memoryObjects_.end(); ++objIt)
+    objIt->second->d->dropSymbols(folded);
+  cleanupMemoryObjects();
+}
+
+/// Cycle is named after its symbols, long cycle after the first of them
+static std::string cycleName(const std::vector<const Symbol*>& symbols)
+{
+  static const size_t maxNames = 3;
+  std::string name = "[cycle of ";
+  for (size_t i = 0; i < symbols.size() && i < maxNames; ++i)
+    name += (i ? ", " : "") + symbols[i]->second->name();
+  if (symbols.size() > maxNames)
+    name += ", ...";
+  return name + ']';
+}
+
+void ProfilePrivate::collapseCycles(const std::vector<std::vector<const Symbol*> >& cycles)
+{
+  if (cycles.empty())
+    return;
+
+  // Every cycle gets one byte of "[cycles]" object with its symbol and the only entry. Names are given for symbol
+  // details even for object ones, so cycles of objects don't become one symbol.
+  MemoryObjectData* object = new MemoryObjectData("[cycles]");
+  memoryObjects_.insert(MemoryObject(Range(cyclesAddress, cyclesAddress + cycles.size()), object));
+  std::map<Range, std::string> names;
+  for (size_t i = 0; i < cycles.size(); ++i)
+  {
+    object->d->appendEntry(cyclesAddress + i, 0, 0);
+    names[Range(i, i + 1)] = cycleName(cycles[i]);
+  }
+  AddressResolver r(Profile::Symbols, "[cycles]", cycles.size(), names);
+  object->d->resolveEntries(r, cyclesAddress, 0);
+
+  FoldTargets folded;
+  SymbolStorage::const_iterator symIt = object->d->symbols_.begin();
+  EntryStorage::const_iterator entryIt = object->d->entries_.begin();
+  for (size_t i = 0; i < cycles.size(); ++i, ++symIt, ++entryIt)
+  {
+    FoldTarget target = { &*symIt, entryIt->second, entryIt->first };
+    for (std::vector<const Symbol*>::const_iterator memberIt = cycles[i].begin(); memberIt != cycles[i].end();
+         ++memberIt)
+      folded[*memberIt] = target;
+  }
+  foldSymbols(folded);
 }
 
 // Profile methods
@@ -424,31 +1263,51 @@ Profile::~Profile() { delete d; }
 
 void Profile::load(std::istream &is, Mode mode)
 {
-  pe::perf_event event;
-  while (!is.eof() && !is.fail())
-  {
-    is >> event;
-    if (is.eof() || is.fail())
-      break;
-    switch (event.header.type)
-    {
-    case PERF_RECORD_MMAP:
-      d->processMmapEvent(event.mmap);
-      break;
-    case PERF_RECORD_SAMPLE:
-      d->processSampleEvent(event.sample, mode);
-    }
-  }
+  d->mode_ = mode;
+  d->read(is);
+}
+
+size_t Profile::update(std::istream& is) { return d->read(is); }
 
-  d->cleanupMemoryObjects();
+void Profile::setJitDirectory(const char* path) { d->jitDirectory_ = path; }
+
+void Profile::setKeepStacks(bool value) { d->keepStacks_ = value; }
+
+void Profile::setKeepSamples(bool value)
+{
+  d->keepSamples_ = value;
+  if (value)
+    d->keepStacks_ = true;
 }
 
+void Profile::setDedupCallSites(bool value) { d->dedupCallSites_ = value; }
+
+void Profile::setFollow(bool value) { d->follow_ = value; }
+
 size_t Profile::mmapEventCount() const { return d->mmapEventCount_; }
 
 size_t Profile::goodSamplesCount() const { return d->goodSamplesCount_; }
 
 size_t Profile::badSamplesCount() const { return d->badSamplesCount_; }
 
+size_t Profile::badRecordsCount() const { return d->badRecordsCount_; }
+
 void Profile::resolveAndFixup(DetailLevel details) { d->resolveAndFixup(details); }
 
+void Profile::foldObjects(const std::vector<const MemoryObjectData*>& objects) { d->foldObjects(objects); }
+
+void Profile::foldSymbols(const std::tr1::unordered_set<const Symbol*>& symbols) { d->foldSymbols(symbols); }
+
+void Profile::collapseCycles(const std::vector<std::vector<const Symbol*> >& cycles) { d->collapseCycles(cycles); }
+
 const MemoryObjectStorage& Profile::memoryObjects() const { return d->memoryObjects_; }
+
+const StackStorage& Profile::stacks() const { return d->stacks_; }
+
+const SampleStorage& Profile::samples() const { return d->samples_; }
+
+bool Profile::hasSampleTimes() const { return d->sampleType_ & PERF_SAMPLE_TIME; }
+
+bool Profile::hasSamplePeriods() const { return d->sampleType_ & PERF_SAMPLE_PERIOD; }
+
+const std::vector<std::string>& Profile::events() const { return d->events_; }
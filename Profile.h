@@ -3,6 +3,10 @@
 
 #include <istream>
 #include <map>
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+#include <tr1/unordered_set>
 #include <stdint.h>
 
 typedef uint64_t Address;
@@ -34,8 +38,13 @@ class SymbolData
 {
 public:
   const std::string& name() const;
+  /// Name before demangling, as it is known to compiler and linker
+  const std::string& linkageName() const;
   const std::string& sourceFile() const;
+  /// Line of the first instruction
   size_t sourceLine() const;
+  /// Entry of procedure linkage table, made by linker and not by compiler
+  bool isPlt() const;
 private:
   friend class MemoryObjectDataPrivate;
   SymbolData(const SymbolData&);
@@ -65,14 +74,66 @@ union BranchTo
   bool operator<(const BranchTo& other) const { return address < other.address; }
 };
 
-typedef std::map<BranchTo, Count> BranchStorage;
+/// Counts of every event of profile at one location, see \ref Profile::events()
+/** The first event is the main one, it is kept inline, so single event profiles don't pay for heap allocations.
+ *  Counts of other events are allocated when they are added for the first time. */
+class Costs
+{
+public:
+  Costs() : main_(0) {}
+
+  Count main() const { return main_; }
+  Count operator[](size_t event) const
+  {
+    return event == 0 ? main_ : event <= others_.size() ? others_[event - 1] : 0;
+  }
+  /// Number of counts up to the last added event, the rest are zero
+  size_t size() const { return others_.size() + 1; }
+  /// True if all counts are zero
+  bool empty() const
+  {
+    for (std::vector<Count>::const_iterator it = others_.begin(); it != others_.end(); ++it)
+      if (*it)
+        return false;
+    return main_ == 0;
+  }
+
+  void add(size_t event, Count count)
+  {
+    if (event == 0)
+    {
+      main_ += count;
+      return;
+    }
+    if (others_.size() < event)
+      others_.resize(event);
+    others_[event - 1] += count;
+  }
+  Costs& operator+=(const Costs& other)
+  {
+    main_ += other.main_;
+    if (others_.size() < other.others_.size())
+      others_.resize(other.others_.size());
+    for (size_t i = 0; i < other.others_.size(); ++i)
+      others_[i] += other.others_[i];
+    return *this;
+  }
+
+private:
+  Count main_;
+  std::vector<Count> others_;
+};
+
+typedef std::map<BranchTo, Costs> BranchStorage;
 typedef BranchStorage::value_type Branch;
 
 class EntryDataPrivate;
 class EntryData
 {
 public:
+  /// Count of the main event
   Count count() const;
+  const Costs& costs() const;
   const BranchStorage& branches() const;
   const std::string& sourceFile() const;
   size_t sourceLine() const;
@@ -81,7 +142,7 @@ private:
   EntryData(const EntryData&);
   EntryData& operator=(const EntryData&);
 
-  explicit EntryData(Count count);
+  explicit EntryData(const Costs& costs);
   ~EntryData();
   EntryDataPrivate* d;
 };
@@ -95,6 +156,8 @@ class MemoryObjectData
 public:
   Address baseAddress() const;
   const std::string& fileName() const;
+  /// Offset in file of mapping start, as mmap event tells
+  Size fileOffset() const;
   const EntryStorage& entries() const;
   const SymbolStorage& symbols() const;
 private:
@@ -111,6 +174,62 @@ private:
 typedef std::map<Range, MemoryObjectData*> MemoryObjectStorage;
 typedef MemoryObjectStorage::value_type MemoryObject;
 
+/// Finds memory objects by address
+/** Lookups usually go to few objects, so the last found object is checked first. */
+class ObjectFinder
+{
+public:
+  explicit ObjectFinder(const MemoryObjectStorage& objects) : objects_(objects), last_(0) {}
+
+  /// Returns 0 if there is no object for address
+  const MemoryObject* find(Address address)
+  {
+    if (!last_ || address < last_->first.start || address >= last_->first.end)
+    {
+      MemoryObjectStorage::const_iterator objIt = objects_.find(Range(address));
+      if (objIt == objects_.end())
+        return 0;
+      last_ = &*objIt;
+    }
+    return last_;
+  }
+
+private:
+  const MemoryObjectStorage& objects_;
+  const MemoryObject* last_;
+};
+
+/// Addresses of sample and its callers, innermost frame first
+typedef std::vector<Address> Stack;
+
+struct StackHash
+{
+  size_t operator()(const Stack& stack) const
+  {
+    // FNV-1a over frame addresses
+    uint64_t hash = 14695981039346656037ULL;
+    for (Stack::const_iterator frameIt = stack.begin(); frameIt != stack.end(); ++frameIt)
+      hash = (hash ^ *frameIt) * 1099511628211ULL;
+    return hash;
+  }
+};
+
+/// Distinct stacks with cost of their samples, repeated stack costs one hash lookup
+/** Cost is number of samples, or sum of their periods for files with periods, as costs of entries are. */
+typedef std::tr1::unordered_map<Stack, Count, StackHash> StackStorage;
+
+/// Sample with its time and thread, see \ref Profile::setKeepSamples()
+struct TimedSample
+{
+  /// Nanoseconds of sample clock, 0 for files recorded without time
+  uint64_t time;
+  uint32_t pid;
+  uint32_t tid;
+  /// Key of \ref StackStorage
+  const Stack* stack;
+};
+typedef std::vector<TimedSample> SampleStorage;
+
 class ProfilePrivate;
 
 class Profile
@@ -121,14 +240,56 @@ public:
   Profile();
   ~Profile();
 
+  /// Directory with perf-PID.map and jit-PID.dump files, /tmp by default
+  void setJitDirectory(const char* path);
+  /// Keep every distinct stack in addition to entries and branches, off by default to save memory
+  void setKeepStacks(bool value);
+  /// Keep every sample in order of recording, implies keeping stacks
+  void setKeepSamples(bool value);
+  /// Count every sample at most once for each call site of its stack, off by default
+  /** Calls of recursive and mutually recursive functions repeat in stack, without deduplication each repetition adds
+   *  sample to the same call again, and inclusive costs of such calls exceed the total. Direct recursion through
+   *  one call site adds its call once anyway, and calls of function to itself are dropped by
+   *  \ref resolveAndFixup, so this matters for cycles of several functions, see also \ref collapseCycles. Stacks
+   *  keep every frame. */
+  void setDedupCallSites(bool value);
+  /// Keep reading position and resolvers for \ref update, off by default
+  void setFollow(bool value);
   void load(std::istream& is, Mode mode = CallGraph);
+  /// Loads records appended to stream since \ref load or previous update, returns number of new records
+  /** Profile should be loaded with \ref setFollow(), so incomplete record at the end is read again next time.
+   *  New samples are kept aside until \ref resolveAndFixup, which resolves only addresses it has not seen yet. */
+  size_t update(std::istream& is);
   size_t mmapEventCount() const;
   size_t goodSamplesCount() const;
   size_t badSamplesCount() const;
+  /// Malformed records other than samples, they are skipped
+  size_t badRecordsCount() const;
 
   void resolveAndFixup(DetailLevel details);
 
+  /// Moves costs of objects into "[other]" object, calls to them become calls to it
+  /** Must be called before \ref resolveAndFixup, so folded objects are never resolved. */
+  void foldObjects(const std::vector<const MemoryObjectData*>& objects);
+  /// Moves costs of symbols into "[other]" symbol after \ref resolveAndFixup, calls to them become calls to it
+  void foldSymbols(const std::tr1::unordered_set<const Symbol*>& symbols);
+  /// Moves costs of every cycle of symbols into one symbol of "[cycles]" object after \ref resolveAndFixup
+  /** Cycles are usually strongly connected components of call graph, which are found by \ref CallGraph. Calls
+   *  within cycle are dropped, calls to its symbols become calls to the new symbol, adjacent frames of cycle in
+   *  stacks become one. Should be called once. */
+  void collapseCycles(const std::vector<std::vector<const Symbol*> >& cycles);
+
   const MemoryObjectStorage& memoryObjects() const;
+  /// Addresses are the same as entry addresses, frames outside of memory objects are dropped
+  const StackStorage& stacks() const;
+  const SampleStorage& samples() const;
+  /// False for files recorded by old pgcollect without sample times
+  bool hasSampleTimes() const;
+  /// True if costs are sums of sample periods instead of sample counts, files with several events have them
+  bool hasSamplePeriods() const;
+  /// Names of events in order of \ref Costs, files recorded without event list have only "Cycles"
+  /** Stacks and samples are kept for the main event only. */
+  const std::vector<std::string>& events() const;
 
 private:
   Profile(const Profile&);
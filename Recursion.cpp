@@ -0,0 +1,133 @@
+#include "Recursion.h"
+#include "FoldedStacks.h"
+#include "OutputBuffer.h"
+
+#include <algorithm>
+#include <tr1/unordered_map>
+
+/// Index of depth range 1, 2-3, 4-7 and so on
+static size_t depthRange(size_t depth)
+{
+  size_t result = 0;
+  for (; depth > 1; depth >>= 1)
+    ++result;
+  return result;
+}
+
+/// Orders units by samples with recursion, then by all their samples
+struct UnitGreater
+{
+  template <class Unit>
+  bool operator()(const Unit* lhs, const Unit* rhs) const
+  {
+    if (lhs->recursive != rhs->recursive)
+      return lhs->recursive > rhs->recursive;
+    if (lhs->samples != rhs->samples)
+      return lhs->samples > rhs->samples;
+    return lhs < rhs;
+  }
+};
+
+Recursion::Recursion(const Profile& profile, size_t top)
+  : graph_(profile)
+  , total_(0)
+  , top_(top)
+{
+  const CallGraph::NodeStorage& nodes = graph_.nodes();
+  std::tr1::unordered_map<const Symbol*, size_t> cycles;
+  for (size_t i = 0; i < nodes.size(); ++i)
+  {
+    if (units_.size() <= nodes[i].cycle)
+      units_.resize(nodes[i].cycle + 1);
+    units_[nodes[i].cycle].nodes.push_back(i);
+    cycles[nodes[i].symbol] = nodes[i].cycle;
+  }
+
+  // Frames of every cycle in current stack, cycles met in it are listed to reset them for the next one
+  std::vector<size_t> frames(units_.size(), 0);
+  std::vector<size_t> stackCycles;
+
+  StackResolver resolver(profile);
+  SymbolStack symbolStack;
+  const StackStorage& stacks = profile.stacks();
+  for (StackStorage::const_iterator stackIt = stacks.begin(); stackIt != stacks.end(); ++stackIt)
+  {
+    total_ += stackIt->second;
+    resolver.resolve(stackIt->first, symbolStack);
+    stackCycles.clear();
+    for (SymbolStack::const_iterator symIt = symbolStack.begin(); symIt != symbolStack.end(); ++symIt)
+    {
+      std::tr1::unordered_map<const Symbol*, size_t>::const_iterator cycleIt = cycles.find(*symIt);
+      if (cycleIt == cycles.end())
+        continue;
+      if (frames[cycleIt->second]++ == 0)
+        stackCycles.push_back(cycleIt->second);
+    }
+
+    for (std::vector<size_t>::const_iterator cycleIt = stackCycles.begin(); cycleIt != stackCycles.end(); ++cycleIt)
+    {
+      Unit& unit = units_[*cycleIt];
+      size_t depth = frames[*cycleIt];
+      frames[*cycleIt] = 0;
+      unit.samples += stackIt->second;
+      if (depth > 1)
+        unit.recursive += stackIt->second;
+      unit.depths += depth * stackIt->second;
+      unit.maxDepth = std::max(unit.maxDepth, depth);
+      size_t range = depthRange(depth);
+      if (unit.histogram.size() <= range)
+        unit.histogram.resize(range + 1, 0);
+      unit.histogram[range] += stackIt->second;
+    }
+  }
+}
+
+void Recursion::writeUnit(OutputBuffer& os, const Unit& unit) const
+{
+  const CallGraph::NodeStorage& nodes = graph_.nodes();
+  if (unit.nodes.size() == 1)
+    os << '\n';
+  else
+    os << "\nCycle of " << unit.nodes.size() << " symbols:\n";
+  for (std::vector<size_t>::const_iterator nodeIt = unit.nodes.begin(); nodeIt != unit.nodes.end(); ++nodeIt)
+  {
+    const CallGraph::Node& node = nodes[*nodeIt];
+    os << (unit.nodes.size() == 1 ? "" : "  ") << node.symbol->second->name() << " ("
+       << BaseName(node.object->fileName()) << ")\n";
+  }
+
+  os << "  samples " << unit.samples << ", recursive " << Percent(unit.recursive, unit.samples, 0)
+     << ", max depth " << unit.maxDepth << ", average depth " << Fixed(double(unit.depths) / unit.samples) << '\n'
+     << "       Depth     Samples   Samples%\n";
+  for (size_t i = 0; i < unit.histogram.size(); ++i)
+  {
+    if (!unit.histogram[i])
+      continue;
+    size_t first = size_t(1) << i;
+    size_t last = std::min((first << 1) - 1, unit.maxDepth);
+    unsigned used = decimalDigits(first);
+    if (last != first)
+      used += decimalDigits(last) + 1;
+    os << Padding(12, used) << first;
+    if (last != first)
+      os << '-' << last;
+    os << Padded(unit.histogram[i], 12) << Percent(unit.histogram[i], unit.samples, 10) << '\n';
+  }
+}
+
+void Recursion::write(OutputBuffer& os) const
+{
+  std::vector<const Unit*> recursive;
+  for (std::vector<Unit>::const_iterator unitIt = units_.begin(); unitIt != units_.end(); ++unitIt)
+    if (unitIt->recursive || (unitIt->nodes.size() > 1 && unitIt->samples))
+      recursive.push_back(&*unitIt);
+  size_t count = std::min(top_, recursive.size());
+  std::partial_sort(recursive.begin(), recursive.begin() + count, recursive.end(), UnitGreater());
+
+  os << "Samples: " << total_ << ", recursive symbols and cycles: " << recursive.size() << '\n'
+     << "Depth is number of frames of symbol or of all symbols of cycle in one stack\n";
+  for (size_t i = 0; i < count; ++i)
+    writeUnit(os, *recursive[i]);
+  if (recursive.size() > count)
+    os << "\n... " << recursive.size() - count << " more\n";
+}
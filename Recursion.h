@@ -0,0 +1,46 @@
+#ifndef RECURSION_H
+#define RECURSION_H
+
+#include "CallGraph.h"
+
+#include <vector>
+
+class OutputBuffer;
+
+/// Report of recursive symbols and cycles of mutually recursive symbols with distribution of their depths
+/** Cycles are strongly connected components of symbol call graph, recursion depth of symbol or cycle is number of
+ *  its frames in one stack. Depths are counted over \ref Profile::stacks(), so profile should be loaded with
+ *  \ref Profile::setKeepStacks(). Tail calls leave no frames in stacks, so recursion through them is not seen. */
+class Recursion
+{
+public:
+  Recursion(const Profile& profile, size_t top);
+
+  void write(OutputBuffer& os) const;
+
+private:
+  /// Symbol or cycle with samples, which have it on stack
+  struct Unit
+  {
+    Unit() : samples(0), recursive(0), depths(0), maxDepth(0) {}
+    /// Indexes of call graph nodes
+    std::vector<size_t> nodes;
+    Count samples;
+    /// Samples with two or more frames of unit
+    Count recursive;
+    /// Sum of depths of all samples, for average depth
+    Count depths;
+    size_t maxDepth;
+    /// Samples by depth ranges 1, 2-3, 4-7 and so on
+    std::vector<Count> histogram;
+  };
+
+  void writeUnit(OutputBuffer& os, const Unit& unit) const;
+
+  CallGraph graph_;
+  std::vector<Unit> units_;
+  Count total_;
+  size_t top_;
+};
+
+#endif // RECURSION_H
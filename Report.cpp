@@ -0,0 +1,215 @@
+#include "Report.h"
+#include "OutputBuffer.h"
+
+#include <algorithm>
+#include <tr1/unordered_map>
+
+/// Number of the most expensive symbols, which are shown with their callers and callees
+static const size_t detailedSymbols = 5;
+/// Callers and callees shown for each of them
+static const size_t detailedCalls = 10;
+
+/// Orders items by sort key, then by the other cost, items with equal costs keep their order
+template <class Item>
+class CostGreater
+{
+public:
+  explicit CostGreater(Report::SortKey key) : key_(key) {}
+
+  bool operator()(const Item* lhs, const Item* rhs) const
+  {
+    Count leftMain = key_ == Report::Self ? lhs->self : lhs->inclusive;
+    Count rightMain = key_ == Report::Self ? rhs->self : rhs->inclusive;
+    if (leftMain != rightMain)
+      return leftMain > rightMain;
+    Count leftOther = key_ == Report::Self ? lhs->inclusive : lhs->self;
+    Count rightOther = key_ == Report::Self ? rhs->inclusive : rhs->self;
+    if (leftOther != rightOther)
+      return leftOther > rightOther;
+    return lhs < rhs;
+  }
+
+private:
+  Report::SortKey key_;
+};
+
+/// Puts pointers to top items with non-zero cost into result, the most expensive first
+template <class Item>
+static void selectTop(const std::vector<Item>& items, size_t top, Report::SortKey key,
+                      std::vector<const Item*>& result)
+{
+  result.clear();
+  for (typename std::vector<Item>::const_iterator it = items.begin(); it != items.end(); ++it)
+    if (it->self || it->inclusive)
+      result.push_back(&*it);
+  size_t count = std::min(top, result.size());
+  std::partial_sort(result.begin(), result.begin() + count, result.end(), CostGreater<Item>(key));
+  result.resize(count);
+}
+
+struct LineLess
+{
+  bool operator()(const Report::Line& lhs, const Report::Line& rhs) const
+  {
+    if (lhs.file != rhs.file)
+      return *lhs.file < *rhs.file;
+    return lhs.line < rhs.line;
+  }
+};
+
+struct EdgeCountGreater
+{
+  bool operator()(const CallGraph::Edge* lhs, const CallGraph::Edge* rhs) const
+  {
+    return lhs->count > rhs->count || (lhs->count == rhs->count && lhs < rhs);
+  }
+};
+
+Report::Report(const Profile& profile, size_t top, SortKey sortKey)
+  : profile_(profile)
+  , top_(top)
+  , sortKey_(sortKey)
+  , objects_(profile, CallGraph::Objects)
+  , symbols_(profile, CallGraph::Symbols)
+{
+  collectLines(profile);
+}
+
+void Report::collectLines(const Profile& profile)
+{
+  // Calls from line cost no more than inclusive cost of callee, as in call graph
+  std::tr1::unordered_map<const Symbol*, Count> calleeCosts;
+  const CallGraph::NodeStorage& nodes = symbols_.nodes();
+  for (CallGraph::NodeStorage::const_iterator nodeIt = nodes.begin(); nodeIt != nodes.end(); ++nodeIt)
+    calleeCosts[nodeIt->symbol] = nodeIt->inclusive;
+
+  const MemoryObjectStorage& objects = profile.memoryObjects();
+  for (MemoryObjectStorage::const_iterator objIt = objects.begin(); objIt != objects.end(); ++objIt)
+  {
+    const SymbolStorage& symbols = objIt->second->symbols();
+    const EntryStorage& entries = objIt->second->entries();
+    SymbolStorage::const_iterator symIt = symbols.end();
+    for (EntryStorage::const_iterator entryIt = entries.begin(); entryIt != entries.end(); ++entryIt)
+    {
+      // Line 0 is unknown position, entries have it unless profile is resolved with sources
+      const EntryData& entry = *entryIt->second;
+      if (entry.sourceLine() == 0)
+        continue;
+      if (symIt == symbols.end() || entryIt->first >= symIt->first.end)
+        symIt = symbols.find(Range(entryIt->first));
+      if (symIt == symbols.end())
+        continue;
+
+      Line line = { &entry.sourceFile(), entry.sourceLine(), &*symIt, entry.count(), entry.count() };
+      const BranchStorage& branches = entry.branches();
+      for (BranchStorage::const_iterator branchIt = branches.begin(); branchIt != branches.end(); ++branchIt)
+        line.inclusive += std::min(branchIt->second.main(), calleeCosts[branchIt->first.symbol]);
+      lines_.push_back(line);
+    }
+  }
+
+  std::sort(lines_.begin(), lines_.end(), LineLess());
+  std::vector<Line>::iterator last = lines_.begin();
+  for (std::vector<Line>::const_iterator lineIt = lines_.begin(); lineIt != lines_.end(); ++lineIt)
+  {
+    if (last != lines_.begin() && last[-1].file == lineIt->file && last[-1].line == lineIt->line)
+    {
+      last[-1].self += lineIt->self;
+      last[-1].inclusive += lineIt->inclusive;
+    }
+    else
+      *last++ = *lineIt;
+  }
+  lines_.erase(last, lines_.end());
+
+  Count total = symbols_.total();
+  for (std::vector<Line>::iterator lineIt = lines_.begin(); lineIt != lines_.end(); ++lineIt)
+    lineIt->inclusive = std::min(lineIt->inclusive, total);
+}
+
+void Report::writeCalls(OutputBuffer& os, size_t node) const
+{
+  const CallGraph::EdgeStorage& edges = symbols_.edges();
+  std::vector<const CallGraph::Edge*> callers;
+  std::vector<const CallGraph::Edge*> callees;
+  for (CallGraph::EdgeStorage::const_iterator edgeIt = edges.begin(); edgeIt != edges.end(); ++edgeIt)
+  {
+    if (edgeIt->to == node)
+      callers.push_back(&*edgeIt);
+    if (edgeIt->from == node)
+      callees.push_back(&*edgeIt);
+  }
+
+  const CallGraph::NodeStorage& nodes = symbols_.nodes();
+  for (int calleesPass = 0; calleesPass < 2; ++calleesPass)
+  {
+    std::vector<const CallGraph::Edge*>& calls = calleesPass ? callees : callers;
+    if (calls.empty())
+      continue;
+    size_t count = std::min(detailedCalls, calls.size());
+    std::partial_sort(calls.begin(), calls.begin() + count, calls.end(), EdgeCountGreater());
+    os << (calleesPass ? "  callees:\n" : "  callers:\n");
+    for (size_t i = 0; i < count; ++i)
+    {
+      const CallGraph::Node& other = nodes[calleesPass ? calls[i]->to : calls[i]->from];
+      os << "  " << Percent(calls[i]->count, symbols_.total(), 8) << "  " << Padded(calls[i]->count, 10)
+         << "  " << other.symbol->second->name() << " (" << BaseName(other.object->fileName()) << ")\n";
+    }
+    if (calls.size() > count)
+      os << "    ... " << calls.size() - count << " more\n";
+  }
+}
+
+void Report::write(OutputBuffer& os) const
+{
+  Count total = symbols_.total();
+  os << "Samples: " << total << ", bad samples: " << profile_.badSamplesCount() << ", sorted by "
+     << (sortKey_ == Self ? "self" : "inclusive") << " cost\n";
+
+  static const char header[] = "     Self%  Inclusive%        Self   Inclusive  ";
+
+  std::vector<const CallGraph::Node*> topObjects;
+  selectTop(objects_.nodes(), top_, sortKey_, topObjects);
+  os << "\nObjects\n" << header << "Object\n";
+  for (std::vector<const CallGraph::Node*>::const_iterator it = topObjects.begin(); it != topObjects.end(); ++it)
+  {
+    os << Percent((*it)->self, total, 10) << Percent((*it)->inclusive, total, 12) << Padded((*it)->self, 12)
+       << Padded((*it)->inclusive, 12) << "  " << (*it)->object->fileName() << '\n';
+  }
+
+  std::vector<const CallGraph::Node*> topSymbols;
+  selectTop(symbols_.nodes(), top_, sortKey_, topSymbols);
+  os << "\nSymbols\n" << header << "Symbol (object)\n";
+  for (std::vector<const CallGraph::Node*>::const_iterator it = topSymbols.begin(); it != topSymbols.end(); ++it)
+  {
+    os << Percent((*it)->self, total, 10) << Percent((*it)->inclusive, total, 12) << Padded((*it)->self, 12)
+       << Padded((*it)->inclusive, 12) << "  " << (*it)->symbol->second->name() << " ("
+       << BaseName((*it)->object->fileName()) << ")\n";
+  }
+
+  if (!lines_.empty())
+  {
+    std::vector<const Line*> topLines;
+    selectTop(lines_, top_, sortKey_, topLines);
+    os << "\nSource lines\n" << header << "Line (symbol)\n";
+    for (std::vector<const Line*>::const_iterator it = topLines.begin(); it != topLines.end(); ++it)
+    {
+      os << Percent((*it)->self, total, 10) << Percent((*it)->inclusive, total, 12) << Padded((*it)->self, 12)
+         << Padded((*it)->inclusive, 12) << "  " << *(*it)->file << ':' << (*it)->line << " ("
+         << (*it)->symbol->second->name() << ")\n";
+    }
+  }
+
+  // Flat profiles have no calls to show
+  if (symbols_.edges().empty())
+    return;
+  size_t detailed = std::min(detailedSymbols, topSymbols.size());
+  os << "\nCallers and callees of top " << detailed << " symbols\n";
+  for (size_t i = 0; i < detailed; ++i)
+  {
+    os << '\n' << topSymbols[i]->symbol->second->name() << " (" << BaseName(topSymbols[i]->object->fileName())
+       << "), self " << Percent(topSymbols[i]->self, total, 0) << ", inclusive "
+       << Percent(topSymbols[i]->inclusive, total, 0) << '\n';
+    writeCalls(os, topSymbols[i] - &symbols_.nodes()[0]);
+  }
+}
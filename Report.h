@@ -0,0 +1,47 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "CallGraph.h"
+
+#include <string>
+#include <vector>
+
+class OutputBuffer;
+
+/// Text report with the most expensive objects, symbols and source lines, to be read right in terminal
+/** Only top rows are sorted with partial sort, so report is fast for huge profiles too. The most expensive symbols
+ *  are followed by their callers and callees. Source lines are reported for profiles resolved with
+ *  \ref Profile::Sources details only. */
+class Report
+{
+public:
+  enum SortKey { Self, Inclusive };
+
+  Report(const Profile& profile, size_t top, SortKey sortKey);
+
+  void write(OutputBuffer& os) const;
+
+  /// Costs of one source line, inclusive cost adds calls made from it
+  struct Line
+  {
+    const std::string* file;
+    size_t line;
+    /// Symbol of the first entry of line
+    const Symbol* symbol;
+    Count self;
+    Count inclusive;
+  };
+
+private:
+  void collectLines(const Profile& profile);
+  void writeCalls(OutputBuffer& os, size_t node) const;
+
+  const Profile& profile_;
+  size_t top_;
+  SortKey sortKey_;
+  CallGraph objects_;
+  CallGraph symbols_;
+  std::vector<Line> lines_;
+};
+
+#endif // REPORT_H
@@ -0,0 +1,70 @@
+#include "SampleProfile.h"
+#include "OutputBuffer.h"
+
+SampleProfile::SampleProfile(const Profile& profile)
+{
+  const MemoryObjectStorage& objects = profile.memoryObjects();
+  for (MemoryObjectStorage::const_iterator objIt = objects.begin(); objIt != objects.end(); ++objIt)
+  {
+    const SymbolStorage& symbols = objIt->second->symbols();
+    const EntryStorage& entries = objIt->second->entries();
+    SymbolStorage::const_iterator symIt = symbols.end();
+    Function* function = 0;
+    for (EntryStorage::const_iterator entryIt = entries.begin(); entryIt != entries.end(); ++entryIt)
+    {
+      if (symIt == symbols.end() || entryIt->first >= symIt->first.end)
+      {
+        symIt = symbols.find(Range(entryIt->first));
+        // Functions without debug information have no lines
+        function = symIt != symbols.end() && symIt->second->sourceLine() != 0 ?
+              &functions_[symIt->second->linkageName()] : 0;
+      }
+      if (!function)
+        continue;
+
+      const EntryData& entry = *entryIt->second;
+      const SymbolData& symbol = *symIt->second;
+      if (&entry.sourceFile() != &symbol.sourceFile() || entry.sourceLine() < symbol.sourceLine())
+        continue;
+
+      LineSamples& line = function->lines[entry.sourceLine() - symbol.sourceLine()];
+      line.self += entry.count();
+      const BranchStorage& branches = entry.branches();
+      for (BranchStorage::const_iterator branchIt = branches.begin(); branchIt != branches.end(); ++branchIt)
+        line.calls[branchIt->first.symbol->second->linkageName()] += branchIt->second.main();
+    }
+  }
+
+  for (std::map<std::string, Function>::iterator funcIt = functions_.begin(); funcIt != functions_.end(); ++funcIt)
+  {
+    Function& function = funcIt->second;
+    for (std::map<size_t, LineSamples>::iterator lineIt = function.lines.begin(); lineIt != function.lines.end();
+         ++lineIt)
+      function.total += lineIt->second.self;
+    if (!function.lines.empty() && function.lines.begin()->first == 0)
+      function.head = function.lines.begin()->second.self;
+  }
+}
+
+void SampleProfile::write(OutputBuffer& os) const
+{
+  for (std::map<std::string, Function>::const_iterator funcIt = functions_.begin(); funcIt != functions_.end();
+       ++funcIt)
+  {
+    const Function& function = funcIt->second;
+    if (function.lines.empty())
+      continue;
+    os << funcIt->first << ':' << function.total << ':' << function.head << '\n';
+    for (std::map<size_t, LineSamples>::const_iterator lineIt = function.lines.begin();
+         lineIt != function.lines.end(); ++lineIt)
+    {
+      if (lineIt->second.self == 0 && lineIt->second.calls.empty())
+        continue;
+      os << ' ' << lineIt->first << ": " << lineIt->second.self;
+      for (std::map<std::string, Count>::const_iterator callIt = lineIt->second.calls.begin();
+           callIt != lineIt->second.calls.end(); ++callIt)
+        os << ' ' << callIt->first << ':' << callIt->second;
+      os << '\n';
+    }
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef SAMPLEPROFILE_H
+#define SAMPLEPROFILE_H
+
+#include "Profile.h"
+
+#include <map>
+#include <string>
+
+class OutputBuffer;
+
+/// LLVM sample profile in text format, for clang -fprofile-sample-use
+/** Profile should be resolved with \ref Profile::Sources details. Functions are identified by linkage names, lines by
+ *  offset from the first line of function. Samples of code inlined from other files have no line within function
+ *  and are skipped. Lines and function totals count only samples of their own code, samples of calls made from line
+ *  are listed with call targets, so compiler knows what to inline. Head samples should count calls of function,
+ *  which are not known without LBR, so they are approximated by samples of the first line. */
+class SampleProfile
+{
+public:
+  explicit SampleProfile(const Profile& profile);
+
+  void write(OutputBuffer& os) const;
+
+private:
+  struct LineSamples
+  {
+    LineSamples() : self(0) {}
+    Count self;
+    /// Calls from line by linkage names of callees
+    std::map<std::string, Count> calls;
+  };
+
+  struct Function
+  {
+    Function() : total(0), head(0) {}
+    /// Own samples of all lines
+    Count total;
+    /// Own samples of the first line
+    Count head;
+    std::map<size_t, LineSamples> lines;
+  };
+
+  std::map<std::string, Function> functions_;
+};
+
+#endif // SAMPLEPROFILE_H
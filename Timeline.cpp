@@ -0,0 +1,259 @@
+#include "Timeline.h"
+#include "OutputBuffer.h"
+
+#include <algorithm>
+
+/// Used when there are too few samples to estimate sampling interval
+static const uint64_t defaultInterval = 1000000;
+/// Thread is considered idle when distance between its samples is more than this number of intervals
+static const uint64_t gapIntervals = 3;
+
+struct SampleOrder
+{
+  explicit SampleOrder(const SampleStorage& samples) : samples_(samples) {}
+
+  bool operator()(size_t lhs, size_t rhs) const
+  {
+    const TimedSample& left = samples_[lhs];
+    const TimedSample& right = samples_[rhs];
+    if (left.pid != right.pid)
+      return left.pid < right.pid;
+    if (left.tid != right.tid)
+      return left.tid < right.tid;
+    return left.time < right.time;
+  }
+
+private:
+  const SampleStorage& samples_;
+};
+
+static bool sameThread(const TimedSample& lhs, const TimedSample& rhs)
+{
+  return lhs.pid == rhs.pid && lhs.tid == rhs.tid;
+}
+
+static void writeJsonString(OutputBuffer& os, const std::string& text)
+{
+  static const char hexDigits[] = "0123456789abcdef";
+  os << '"';
+  for (std::string::const_iterator it = text.begin(); it != text.end(); ++it)
+  {
+    unsigned char c = *it;
+    if (c == '"' || c == '\\')
+      os << '\\' << char(c);
+    else if (c < 0x20)
+      os << "\\u00" << hexDigits[c >> 4] << hexDigits[c & 0xf];
+    else
+      os << char(c);
+  }
+  os << '"';
+}
+
+/// Chrome trace times are microseconds
+static void writeMicroseconds(OutputBuffer& os, uint64_t nanoseconds)
+{
+  unsigned fraction = nanoseconds % 1000;
+  os << nanoseconds / 1000 << '.' << char('0' + fraction / 100) << char('0' + fraction / 10 % 10)
+     << char('0' + fraction % 10);
+}
+
+Timeline::Timeline(const Profile& profile)
+{
+  const SampleStorage& samples = profile.samples();
+  if (samples.empty())
+    return;
+
+  std::vector<size_t> order(samples.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), SampleOrder(samples));
+
+  // Median distance between samples of thread
+  std::vector<uint64_t> distances;
+  for (size_t i = 1; i < order.size(); ++i)
+  {
+    const TimedSample& prev = samples[order[i - 1]];
+    const TimedSample& curr = samples[order[i]];
+    if (sameThread(prev, curr) && curr.time > prev.time)
+      distances.push_back(curr.time - prev.time);
+  }
+  uint64_t interval = defaultInterval;
+  if (!distances.empty())
+  {
+    std::nth_element(distances.begin(), distances.begin() + distances.size() / 2, distances.end());
+    interval = distances[distances.size() / 2];
+  }
+  std::vector<uint64_t>().swap(distances);
+
+  // The same address stacks are resolved once, the same symbol stacks get the same index
+  StackResolver resolver(profile);
+  std::tr1::unordered_map<const Stack*, size_t> resolved;
+  std::tr1::unordered_map<SymbolStack, size_t, SymbolStackHash> stackIds;
+  SymbolStack symbolStack;
+  const size_t noStack = size_t(-1);
+
+  uint64_t startTime = samples[order[0]].time;
+  for (size_t i = 0; i < order.size(); ++i)
+    startTime = std::min(startTime, samples[order[i]].time);
+
+  for (size_t i = 0; i < order.size(); ++i)
+  {
+    const TimedSample& sample = samples[order[i]];
+    if (i == 0 || !sameThread(samples[order[i - 1]], sample))
+    {
+      threads_.push_back(Thread());
+      threads_.back().pid = sample.pid;
+      threads_.back().tid = sample.tid;
+    }
+
+    std::pair<std::tr1::unordered_map<const Stack*, size_t>::iterator, bool> resolvedIns =
+        resolved.insert(std::make_pair(sample.stack, noStack));
+    if (resolvedIns.second)
+    {
+      resolver.resolve(*sample.stack, symbolStack);
+      if (!symbolStack.empty())
+      {
+        std::pair<std::tr1::unordered_map<SymbolStack, size_t, SymbolStackHash>::iterator, bool> idIns =
+            stackIds.insert(std::make_pair(symbolStack, stacks_.size()));
+        if (idIns.second)
+          stacks_.push_back(symbolStack);
+        resolvedIns.first->second = idIns.first->second;
+      }
+    }
+    size_t stack = resolvedIns.first->second;
+    if (stack == noStack)
+      continue;
+
+    uint64_t time = sample.time - startTime;
+    std::vector<Run>& runs = threads_.back().runs;
+    if (!runs.empty() && time <= runs.back().end + (gapIntervals - 1) * interval)
+    {
+      // Previous run lasts till this sample
+      runs.back().end = time;
+      if (runs.back().stack == stack)
+      {
+        runs.back().end = time + interval;
+        continue;
+      }
+    }
+    Run run = { stack, time, time + interval };
+    runs.push_back(run);
+  }
+}
+
+void Timeline::write(OutputBuffer& os, Format format) const
+{
+  if (format == ChromeTrace)
+    writeChromeTrace(os);
+  else
+    writeSpeedscope(os);
+}
+
+void Timeline::writeChromeTrace(OutputBuffer& os) const
+{
+  // Every frame becomes complete event, which lasts while frame stays in consecutive runs
+  os << "{\"traceEvents\":[";
+  bool first = true;
+  std::vector<uint64_t> frameStarts;
+  for (std::vector<Thread>::const_iterator threadIt = threads_.begin(); threadIt != threads_.end(); ++threadIt)
+  {
+    const std::vector<Run>& runs = threadIt->runs;
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+      const SymbolStack& stack = stacks_[runs[i].stack];
+      const SymbolStack* next = 0;
+      if (i + 1 < runs.size() && runs[i + 1].start == runs[i].end)
+        next = &stacks_[runs[i + 1].stack];
+
+      // Frames shared with previous run are already open
+      frameStarts.resize(stack.size(), runs[i].start);
+
+      size_t common = 0;
+      while (next && common < next->size() && common < stack.size() && (*next)[common] == stack[common])
+        ++common;
+
+      for (size_t depth = stack.size(); depth-- > common; )
+      {
+        os << (first ? "\n" : ",\n") << "{\"ph\":\"X\",\"pid\":" << threadIt->pid << ",\"tid\":" << threadIt->tid
+           << ",\"ts\":";
+        writeMicroseconds(os, frameStarts[depth]);
+        os << ",\"dur\":";
+        writeMicroseconds(os, runs[i].end - frameStarts[depth]);
+        os << ",\"name\":";
+        writeJsonString(os, stack[depth]->second->name());
+        os << '}';
+        first = false;
+      }
+      frameStarts.resize(common);
+    }
+  }
+  os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+void Timeline::writeSpeedscope(OutputBuffer& os) const
+{
+  // Frames are numbered when first used and written after profiles
+  std::tr1::unordered_map<const Symbol*, size_t> frameIds;
+  std::vector<const Symbol*> frames;
+
+  os << "{\"$schema\":\"https://www.speedscope.app/file-format-schema.json\",\"exporter\":\"pgconvert\","
+        "\"profiles\":[";
+  for (std::vector<Thread>::const_iterator threadIt = threads_.begin(); threadIt != threads_.end(); ++threadIt)
+  {
+    const std::vector<Run>& runs = threadIt->runs;
+    if (threadIt != threads_.begin())
+      os << ',';
+    os << "\n{\"type\":\"sampled\",\"name\":\"pid " << threadIt->pid << " tid " << threadIt->tid
+       << "\",\"unit\":\"nanoseconds\",\"startValue\":0,\"endValue\":" << (runs.empty() ? 0 : runs.back().end)
+       << ",\"samples\":[";
+
+    // Gaps, including one before the first run, are samples without frames, so threads are aligned in time
+    uint64_t time = 0;
+    for (std::vector<Run>::const_iterator runIt = runs.begin(); runIt != runs.end(); ++runIt)
+    {
+      if (runIt != runs.begin())
+        os << ',';
+      if (runIt->start > time)
+        os << "[],";
+      os << '[';
+      const SymbolStack& stack = stacks_[runIt->stack];
+      for (SymbolStack::const_iterator frameIt = stack.begin(); frameIt != stack.end(); ++frameIt)
+      {
+        std::pair<std::tr1::unordered_map<const Symbol*, size_t>::iterator, bool> insResult =
+            frameIds.insert(std::make_pair(*frameIt, frames.size()));
+        if (insResult.second)
+          frames.push_back(*frameIt);
+        if (frameIt != stack.begin())
+          os << ',';
+        os << insResult.first->second;
+      }
+      os << ']';
+      time = runIt->end;
+    }
+
+    os << "],\"weights\":[";
+    time = 0;
+    for (std::vector<Run>::const_iterator runIt = runs.begin(); runIt != runs.end(); ++runIt)
+    {
+      if (runIt != runs.begin())
+        os << ',';
+      if (runIt->start > time)
+        os << runIt->start - time << ',';
+      os << runIt->end - runIt->start;
+      time = runIt->end;
+    }
+    os << "]}";
+  }
+
+  os << "\n],\"shared\":{\"frames\":[";
+  for (std::vector<const Symbol*>::const_iterator frameIt = frames.begin(); frameIt != frames.end(); ++frameIt)
+  {
+    const SymbolData& symbolData = *(*frameIt)->second;
+    os << (frameIt == frames.begin() ? "\n" : ",\n") << "{\"name\":";
+    writeJsonString(os, symbolData.name());
+    os << ",\"file\":";
+    writeJsonString(os, symbolData.sourceFile());
+    os << ",\"line\":" << symbolData.sourceLine() << '}';
+  }
+  os << "\n]}}\n";
+}
@@ -0,0 +1,45 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include "FoldedStacks.h"
+
+class OutputBuffer;
+
+/// Samples of profile laid out in time, one track per thread
+/** Consecutive samples of thread with the same stack are coalesced into one run, which lasts till the next sample
+ *  of thread. Runs are interrupted by gaps, when thread had no samples for several sampling intervals. Sampling
+ *  interval is estimated as median distance between samples of the same thread. Profile should be loaded with
+ *  \ref Profile::setKeepSamples(). */
+class Timeline
+{
+public:
+  enum Format { ChromeTrace, Speedscope };
+
+  explicit Timeline(const Profile& profile);
+
+  void write(OutputBuffer& os, Format format) const;
+
+private:
+  struct Run
+  {
+    size_t stack;
+    uint64_t start;
+    uint64_t end;
+  };
+
+  struct Thread
+  {
+    uint32_t pid;
+    uint32_t tid;
+    std::vector<Run> runs;
+  };
+
+  void writeChromeTrace(OutputBuffer& os) const;
+  void writeSpeedscope(OutputBuffer& os) const;
+
+  /// Distinct resolved stacks, runs refer to them by index
+  std::vector<SymbolStack> stacks_;
+  std::vector<Thread> threads_;
+};
+
+#endif // TIMELINE_H
@@ -10,13 +10,46 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <sys/auxv.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/syscall.h>
 
 #include <linux/perf_event.h>
 
+#include "pgdata.h"
+
+/// Time is needed to match samples with JIT code loads, which are timed with CLOCK_MONOTONIC
+#define PG_SAMPLE_TYPE (PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN)
+/// With several events samples are told apart by id and weighted by period, as events have different rates
+#define PG_MULTI_EVENT_SAMPLE_TYPE (PG_SAMPLE_TYPE | PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_PERIOD)
+
+struct EventType
+{
+  /// Name for -e option
+  const char* option;
+  /// Name written into output, see \ref pg_event_id_event
+  const char* name;
+  __u32 type;
+  __u64 config;
+};
+
+static const struct EventType eventTypes[] =
+{
+  { "cycles", "Cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", "Instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "cache-references", "CacheReferences", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+  { "cache-misses", "CacheMisses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "branches", "Branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+  { "branch-misses", "BranchMisses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { "ref-cycles", "RefCycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES },
+  { "cpu-clock", "CpuClock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK },
+  { "task-clock", "TaskClock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK }
+};
+
 static int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags)
 {
   return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
@@ -28,11 +61,26 @@ struct PGCollectState
   FILE* output;
   size_t taskCount;
   unsigned frequency;
+  int clockId;
+  /// Events from -e option, the first one is the main event, empty list means cycles with old sample format
+  const struct EventType* events[PG_MAX_EVENTS];
+  size_t eventCount;
+  __u64 sampleType;
   int gogoFD;
   unsigned wakeupCount;
   unsigned sampleCount;
   unsigned mmapCount;
   unsigned synthMmapCount;
+  bool vdsoDumped;
+};
+
+struct mmap_event {
+    struct perf_event_header header;
+    __u32    pid, tid;
+    __u64    addr;
+    __u64    len;
+    __u64    pgoff;
+    char   filename[PATH_MAX];
 };
 
 struct PerfMmapArea
@@ -87,17 +135,89 @@ static void collectTasks(struct PGCollectState* state, pid_t pid)
   closedir(taskDir);
 }
 
-static void collectExistingMappings(struct PGCollectState* state)
+static __u64 ownVdsoLength()
+{
+  FILE *mapFile = fopen("/proc/self/maps", "r");
+  if (mapFile == 0)
+    return 0;
+
+  __u64 length = 0;
+  char buf[2 * PATH_MAX];
+  while (fgets(buf, sizeof(buf), mapFile) != 0)
+  {
+    __u64 start, end;
+    char fileName[PATH_MAX] = "";
+    sscanf(buf, "%llx-%llx %*s %*x %*x:%*x %*u %s\n", &start, &end, fileName);
+    if (strcmp(fileName, "[vdso]") == 0)
+    {
+      length = end - start;
+      break;
+    }
+  }
+
+  fclose(mapFile);
+  return length;
+}
+
+static void dumpVdso(struct PGCollectState* state, pid_t pid, __u64 address, __u64 length)
 {
-  struct mmap_event {
-      struct perf_event_header header;
-      __u32    pid, tid;
-      __u64    addr;
-      __u64    len;
-      __u64    pgoff;
-      char   filename[PATH_MAX];
-  };
+  // All processes share the same image, so one copy is enough
+  if (state->vdsoDumped)
+    return;
+  state->vdsoDumped = true;
+
+  char* image = malloc(length);
+  if (!image)
+  {
+    fprintf(stderr, "Can't allocate %llu bytes for vDSO image, vDSO symbols will not be resolved\n",
+            (unsigned long long)length);
+    return;
+  }
+  bool haveImage = false;
+
+  char memFileName[PATH_MAX];
+  snprintf(memFileName, sizeof(memFileName), "/proc/%lld/mem", (long long)pid);
+  int memFD = open(memFileName, O_RDONLY);
+  if (memFD != -1)
+  {
+    haveImage = (pread(memFD, image, length, address) == (ssize_t)length);
+    close(memFD);
+  }
+
+  // We are not allowed to peek into profiled process, but our own vDSO is the same if kernel provides
+  // image of the same size
+  const void* ownVdso = (const void*)getauxval(AT_SYSINFO_EHDR);
+  if (!haveImage && ownVdso && ownVdsoLength() == length)
+  {
+    memcpy(image, ownVdso, length);
+    haveImage = true;
+  }
+
+  if (!haveImage)
+  {
+    fprintf(stderr, "Can't get vDSO image of process %lld, vDSO symbols will not be resolved\n", (long long)pid);
+    free(image);
+    return;
+  }
+
+  struct pg_vdso_event event;
+  event.header.type = PG_RECORD_VDSO;
+  event.header.misc = PERF_RECORD_MISC_USER;
+  for (event.offset = 0; event.offset < length; event.offset += PG_VDSO_CHUNK_SIZE)
+  {
+    size_t chunkSize = length - event.offset < PG_VDSO_CHUNK_SIZE ? length - event.offset : PG_VDSO_CHUNK_SIZE;
+    size_t alignedChunkSize = chunkSize % 8 ? (chunkSize / 8 + 1) * 8 : chunkSize;
+    memcpy(event.data, image + event.offset, chunkSize);
+    memset(event.data + chunkSize, 0, alignedChunkSize - chunkSize);
+    event.header.size = sizeof(struct pg_vdso_event) - PG_VDSO_CHUNK_SIZE + alignedChunkSize;
+    fwrite(&event, event.header.size, 1, state->output);
+  }
+
+  free(image);
+}
 
+static void collectExistingMappings(struct PGCollectState* state)
+{
   char mapFileName[PATH_MAX];
   snprintf(mapFileName, sizeof(mapFileName), "/proc/%lld/maps", (long long)state->pids[0]);
 
@@ -141,6 +261,9 @@ static void collectExistingMappings(struct PGCollectState* state)
 
     fwrite(&event, event.header.size, 1, state->output);
     state->synthMmapCount++;
+
+    if (strcmp(event.filename, "[vdso]") == 0)
+      dumpVdso(state, state->pids[0], event.addr, event.len);
   }
 
   fclose(mapFile);
@@ -150,27 +273,61 @@ static void collectExistingMappings(struct PGCollectState* state)
 static void __attribute__((noreturn))
 printUsage()
 {
-  fprintf(stdout, "Usage: %s outfile.pgdata [-F freq] {-p pid | cmd}\n", program_invocation_short_name);
+  fprintf(stdout, "Usage: %s outfile.pgdata [-F freq] [-e event,...] {-p pid | cmd}\n", program_invocation_short_name);
+  fputs("Events:", stdout);
+  for (size_t i = 0; i < sizeof(eventTypes) / sizeof(eventTypes[0]); i++)
+    fprintf(stdout, " %s", eventTypes[i].option);
+  fputc('\n', stdout);
   exit(EXIT_SUCCESS);
 }
 
+static void parseEvents(struct PGCollectState* state, char* list)
+{
+  state->eventCount = 0;
+  for (char* name = strtok(list, ","); name; name = strtok(0, ","))
+  {
+    size_t i = 0;
+    while (i < sizeof(eventTypes) / sizeof(eventTypes[0]) && strcmp(eventTypes[i].option, name) != 0)
+      i++;
+    if (i == sizeof(eventTypes) / sizeof(eventTypes[0]))
+    {
+      fprintf(stderr, "Unknown event '%s'\n", name);
+      exit(EXIT_FAILURE);
+    }
+    if (state->eventCount == PG_MAX_EVENTS)
+    {
+      fprintf(stderr, "Too many events, at most %d are supported\n", PG_MAX_EVENTS);
+      exit(EXIT_FAILURE);
+    }
+    state->events[state->eventCount++] = &eventTypes[i];
+  }
+  state->sampleType = state->eventCount ? PG_MULTI_EVENT_SAMPLE_TYPE : PG_SAMPLE_TYPE;
+}
+
 static void prepareState(struct PGCollectState* state, int argc, char** argv)
 {
   state->frequency = 1000;
+  state->clockId = CLOCK_MONOTONIC;
+  state->eventCount = 0;
+  state->sampleType = PG_SAMPLE_TYPE;
   state->wakeupCount = 0;
   state->sampleCount = 0;
   state->mmapCount = 0;
   state->synthMmapCount = 0;
+  state->vdsoDumped = false;
 
   int opt;
   pid_t pid = 0;
-  while ((opt = getopt(argc, argv, "F:p:")) != -1)
+  while ((opt = getopt(argc, argv, "F:e:p:")) != -1)
   {
     switch (opt)
     {
     case 'F':
       state->frequency = strtoul(optarg, NULL, 10);
       break;
+    case 'e':
+      parseEvents(state, optarg);
+      break;
     case 'p': {
       state->gogoFD = -1;
       errno = 0;
@@ -277,34 +434,44 @@ static void prepareState(struct PGCollectState* state, int argc, char** argv)
   }
 }
 
-static int createPerfEvent(const struct PGCollectState* state, pid_t pid, int cpu)
+/// Only the main event reports mmaps and tasks, other ones would duplicate them
+static int createPerfEvent(struct PGCollectState* state, pid_t pid, int cpu, size_t eventIdx)
 {
   struct perf_event_attr pe_attr;
   memset(&pe_attr, 0, sizeof(struct perf_event_attr));
 
   bool forkMode = (state->gogoFD != -1);
 
-  pe_attr.type = PERF_TYPE_HARDWARE;
-//  pe_attr.type = PERF_TYPE_SOFTWARE;
+  pe_attr.type = state->eventCount ? state->events[eventIdx]->type : PERF_TYPE_HARDWARE;
   pe_attr.size = sizeof(struct perf_event_attr);
-  pe_attr.config = PERF_COUNT_HW_CPU_CYCLES;
-//  pe_attr.config = PERF_COUNT_SW_CPU_CLOCK;
+  pe_attr.config = state->eventCount ? state->events[eventIdx]->config : PERF_COUNT_HW_CPU_CYCLES;
   pe_attr.sample_freq = state->frequency;
-  pe_attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_CALLCHAIN;
+  pe_attr.sample_type = state->sampleType;
   pe_attr.disabled = forkMode;
   pe_attr.inherit = forkMode;
   pe_attr.exclude_kernel = 1;
   pe_attr.exclude_hv = 1;
-  pe_attr.mmap = 1;
+  pe_attr.mmap = (eventIdx == 0);
   pe_attr.freq = 1;
   pe_attr.enable_on_exec = forkMode;
-  pe_attr.task = 1;
+  pe_attr.task = (eventIdx == 0);
 //  pe_attr.precise_ip = 2;
 
   // Wake for every Xth event
 //  pe_attr.wakeup_events = 5;
 
+  pe_attr.use_clockid = (state->clockId != -1);
+  pe_attr.clockid = state->clockId;
+
   int fd = perf_event_open(&pe_attr, pid, cpu, -1, 0);
+  if (fd == -1 && errno == EINVAL && pe_attr.use_clockid)
+  {
+    // Old kernels don't allow to choose clock, so stay with perf's one
+    state->clockId = -1;
+    pe_attr.use_clockid = 0;
+    pe_attr.clockid = 0;
+    fd = perf_event_open(&pe_attr, pid, cpu, -1, 0);
+  }
   if (fd == -1)
   {
     perror("Can't create performance event file descriptor");
@@ -345,6 +512,40 @@ static void mmapPerfEvent(struct PerfMmapArea* area, int perfEventFD, const stru
   area->mask = size - pageSize -1;
 }
 
+static void writeSampleFormat(struct PGCollectState* state)
+{
+  struct pg_sample_format_event event;
+  memset(&event, 0, sizeof(event));
+  event.header.type = PG_RECORD_SAMPLE_FORMAT;
+  event.header.misc = PERF_RECORD_MISC_USER;
+  event.header.size = sizeof(event);
+  event.sample_type = state->sampleType;
+  event.clockid = state->clockId;
+  fwrite(&event, event.header.size, 1, state->output);
+}
+
+/// Tells which event samples of descriptor belong to, secondary events go into buffer of the main one
+static void attachEvent(struct PGCollectState* state, int mainFD, int perfEventFD, size_t eventIdx)
+{
+  struct pg_event_id_event event;
+  memset(&event, 0, sizeof(event));
+  if (ioctl(perfEventFD, PERF_EVENT_IOC_ID, &event.id) == -1 ||
+      (perfEventFD != mainFD && ioctl(perfEventFD, PERF_EVENT_IOC_SET_OUTPUT, mainFD) == -1))
+  {
+    perror("Can't set up performance event file descriptor");
+    if (state->gogoFD != -1)
+      close(state->gogoFD);
+    exit(EXIT_FAILURE);
+  }
+
+  event.header.type = PG_RECORD_EVENT_ID;
+  event.header.misc = PERF_RECORD_MISC_USER;
+  event.header.size = sizeof(event);
+  event.index = eventIdx;
+  strncpy(event.name, state->events[eventIdx]->name, sizeof(event.name) - 1);
+  fwrite(&event, event.header.size, 1, state->output);
+}
+
 static void fillPollData(struct pollfd* pollData, int perfEventFD)
 {
   pollData->fd = perfEventFD;
@@ -393,14 +594,20 @@ static void processEvents(struct PerfMmapArea* area, struct PGCollectState* stat
 
       if ((area->prev & area->mask) + eventHeader->size != ((area->prev + eventHeader->size) & area->mask))
       {
+        // Make event continuous, we may need to look into it
+        static char eventCopy[USHRT_MAX + 1];
         size_t dataSize = area->mask + 1;
         size_t offset = area->prev & area->mask;
         size_t chunkSize = dataSize - offset;
-        fwrite(eventHeader, chunkSize, 1,  state->output);
-        fwrite(area->data, eventHeader->size - chunkSize, 1, state->output);
+        memcpy(eventCopy, eventHeader, chunkSize);
+        memcpy(eventCopy + chunkSize, area->data, eventHeader->size - chunkSize);
+        eventHeader = (struct perf_event_header*)eventCopy;
       }
-      else
-        fwrite(eventHeader, eventHeader->size, 1, state->output);
+      fwrite(eventHeader, eventHeader->size, 1, state->output);
+
+      const struct mmap_event* mmapEvent = (const struct mmap_event*)eventHeader;
+      if (eventHeader->type == PERF_RECORD_MMAP && strcmp(mmapEvent->filename, "[vdso]") == 0)
+        dumpVdso(state, mmapEvent->pid, mmapEvent->addr, mmapEvent->len);
     }
 
     area->prev += eventHeader->size;
@@ -429,10 +636,12 @@ int main(int argc, char** argv)
 
   if (state.gogoFD != -1)
     for (int cpu = 0; cpu < eventFdCount; cpu++)
-      perfEventFD[cpu] = createPerfEvent(&state, state.pids[0], cpu);
+      perfEventFD[cpu] = createPerfEvent(&state, state.pids[0], cpu, 0);
   else
     for (int pidId = 0; pidId < eventFdCount; pidId++)
-      perfEventFD[pidId] = createPerfEvent(&state, state.pids[pidId], -1);
+      perfEventFD[pidId] = createPerfEvent(&state, state.pids[pidId], -1, 0);
+
+  writeSampleFormat(&state);
 
   for (int eventFdIdx = 0; eventFdIdx < eventFdCount; eventFdIdx++)
   {
@@ -440,6 +649,19 @@ int main(int argc, char** argv)
     fillPollData(&pollData[eventFdIdx], perfEventFD[eventFdIdx]);
   }
 
+  // Secondary events share mmap area of the main event on the same cpu or task, which must be mapped already,
+  // they are kept open till exit
+  for (int eventFdIdx = 0; eventFdIdx < eventFdCount && state.eventCount; eventFdIdx++)
+  {
+    attachEvent(&state, perfEventFD[eventFdIdx], perfEventFD[eventFdIdx], 0);
+    for (size_t eventIdx = 1; eventIdx < state.eventCount; eventIdx++)
+    {
+      int fd = (state.gogoFD != -1) ? createPerfEvent(&state, state.pids[0], eventFdIdx, eventIdx) :
+                                      createPerfEvent(&state, state.pids[eventFdIdx], -1, eventIdx);
+      attachEvent(&state, perfEventFD[eventFdIdx], fd, eventIdx);
+    }
+  }
+
   setupSignalHandlers(signalHandler);
 
   if (state.gogoFD != -1)
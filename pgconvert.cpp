@@ -1,42 +1,168 @@
 #include "Profile.h"
 #include "AddressResolver.h"
+#include "Annotation.h"
+#include "BoltWriter.h"
+#include "CallGraph.h"
+#include "Compressor.h"
+#include "DotGraph.h"
+#include "Filter.h"
+#include "FlameGraph.h"
+#include "Footprint.h"
+#include "FoldedStacks.h"
+#include "FunctionOrder.h"
+#include "OutputBuffer.h"
+#include "PprofWriter.h"
+#include "Recursion.h"
+#include "Report.h"
+#include "SampleProfile.h"
+#include "Timeline.h"
 
 #include <algorithm>
 #include <fstream>
 #include <iostream>
-#include <numeric>
+#include <tr1/unordered_map>
+#include <tr1/unordered_set>
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
 
 #include <getopt.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
 
 struct Params
 {
+  enum Format
+  {
+    Callgrind, Pprof, Folded, Flame, Icicle, Chrome, Speedscope, Dot, TextReport, Annotate, Llvm, Bolt, Order,
+    FootprintReport, RecursionReport
+  };
+
   Params()
-    : mode(Profile::CallGraph)
+    : format(Callgrind)
+    , mode(Profile::CallGraph)
     , details(Profile::Sources)
     , dumpInstructions(false)
+    , coalesceInstructions(false)
+    , dedupCallSites(false)
+    , collapseCycles(false)
+    , mmapOutput(false)
+    , compressOutput(false)
+    , nodeThreshold(0.5)
+    , edgeThreshold(0.1)
+    , reportTop(20)
+    , reportSort(Report::Inclusive)
+    , jitDirectory(0)
+    , annotateTarget(0)
+    , followInterval(0)
     , inputFile(0)
+    , outputFile(0)
   {}
+  Format format;
   Profile::Mode mode;
   Profile::DetailLevel details;
   bool dumpInstructions;
+  /// Consecutive instructions of the same line are written as one, see \ref dumpEntriesWithInstructions
+  bool coalesceInstructions;
+  /// Samples are counted once for every call site, see \ref Profile::setDedupCallSites
+  bool dedupCallSites;
+  /// Every cycle of mutually recursive symbols is one symbol, see \ref Profile::collapseCycles
+  bool collapseCycles;
+  bool mmapOutput;
+  bool compressOutput;
+  /// Percents of all samples for dot output
+  double nodeThreshold;
+  double edgeThreshold;
+  /// Rows in every table of text report
+  size_t reportTop;
+  Report::SortKey reportSort;
+  const char* jitDirectory;
+  /// Symbol or source file for annotated listing
+  const char* annotateTarget;
+  /// Seconds between rewrites of output while input grows, 0 if input is converted once
+  unsigned followInterval;
   const char* inputFile;
+  const char* outputFile;
+  Filter filter;
 };
 
 static void __attribute__((noreturn))
 printUsage()
 {
   std::cout << "Usage: " << program_invocation_short_name <<
-               " [-m {flat|callgraph}] [-d {object|symbol|source}] [-i] filename.pgdata\n";
+               " [-m {flat|callgraph}] [-d {object|symbol|source}] [-i] [--coalesce] [-j jitdir]\n"
+               "       [-o {callgrind|pprof|folded|flamegraph|icicle|chrome|speedscope|dot|llvm|bolt|order}]\n"
+               "       [-M] [-z] [-n node_threshold%] [-e edge_threshold%]\n"
+               "       [--flamegraph output.svg] [--icicle output.svg]\n"
+               "       [--report] [--top N] [--sort {self|inclusive}] [--annotate symbol|file] [--footprint]\n"
+               "       [--include [object:|symbol:]regex] [--exclude [object:|symbol:]regex] [--min-cost percent%]\n"
+               "       [--dedup-call-sites] [--collapse-cycles] [--recursion] [--follow[=seconds]]\n"
+               "       filename.pgdata [output]\n";
   exit(EXIT_SUCCESS);
 }
 
+enum LongOption
+{
+  FlameGraphOption = 256,
+  IcicleOption,
+  ReportOption,
+  TopOption,
+  SortOption,
+  AnnotateOption,
+  FootprintOption,
+  CoalesceOption,
+  IncludeOption,
+  ExcludeOption,
+  MinCostOption,
+  DedupCallSitesOption,
+  CollapseCyclesOption,
+  RecursionOption,
+  FollowOption
+};
+
+static const option longOptions[] =
+{
+  { "flamegraph", required_argument, 0, FlameGraphOption },
+  { "icicle", required_argument, 0, IcicleOption },
+  { "report", no_argument, 0, ReportOption },
+  { "top", required_argument, 0, TopOption },
+  { "sort", required_argument, 0, SortOption },
+  { "annotate", required_argument, 0, AnnotateOption },
+  { "footprint", no_argument, 0, FootprintOption },
+  { "coalesce", no_argument, 0, CoalesceOption },
+  { "include", required_argument, 0, IncludeOption },
+  { "exclude", required_argument, 0, ExcludeOption },
+  { "min-cost", required_argument, 0, MinCostOption },
+  { "dedup-call-sites", no_argument, 0, DedupCallSitesOption },
+  { "collapse-cycles", no_argument, 0, CollapseCyclesOption },
+  { "recursion", no_argument, 0, RecursionOption },
+  { "follow", optional_argument, 0, FollowOption },
+  { 0, 0, 0, 0 }
+};
+
+/// Seconds between rewrites of output for --follow without value
+static const unsigned defaultFollowInterval = 5;
+
+static double parsePercent(const char* value, const char* what)
+{
+  char* end;
+  double percent = strtod(value, &end);
+  if (end != value && *end == '%')
+    ++end;
+  if (end == value || *end != '\0' || percent < 0 || percent > 100)
+  {
+    std::cerr << "Invalid " << what << " '" << value << "'\n";
+    exit(EXIT_FAILURE);
+  }
+  return percent;
+}
+
 static void parseArguments(Params& params, int argc, char* argv[])
 {
   int opt;
-  while ((opt = getopt(argc, argv, "m:d:i")) != -1)
+  while ((opt = getopt_long(argc, argv, "m:d:ij:o:Mzn:e:", longOptions, 0)) != -1)
   {
     switch (opt)
     {
@@ -67,6 +193,128 @@ static void parseArguments(Params& params, int argc, char* argv[])
     case 'i':
       params.dumpInstructions = true;
       break;
+    case 'j':
+      params.jitDirectory = optarg;
+      break;
+    case 'o':
+      if (strcmp(optarg, "callgrind") == 0)
+        params.format = Params::Callgrind;
+      else if (strcmp(optarg, "pprof") == 0)
+        params.format = Params::Pprof;
+      else if (strcmp(optarg, "folded") == 0)
+        params.format = Params::Folded;
+      else if (strcmp(optarg, "flamegraph") == 0)
+        params.format = Params::Flame;
+      else if (strcmp(optarg, "icicle") == 0)
+        params.format = Params::Icicle;
+      else if (strcmp(optarg, "chrome") == 0)
+        params.format = Params::Chrome;
+      else if (strcmp(optarg, "speedscope") == 0)
+        params.format = Params::Speedscope;
+      else if (strcmp(optarg, "dot") == 0)
+        params.format = Params::Dot;
+      else if (strcmp(optarg, "llvm") == 0)
+        params.format = Params::Llvm;
+      else if (strcmp(optarg, "bolt") == 0)
+        params.format = Params::Bolt;
+      else if (strcmp(optarg, "order") == 0)
+        params.format = Params::Order;
+      else
+      {
+        std::cerr << "Invalid output format '" << optarg <<"'\n";
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'M':
+      params.mmapOutput = true;
+      break;
+    case 'z':
+      params.compressOutput = true;
+      break;
+    case 'n':
+      params.nodeThreshold = parsePercent(optarg, "node threshold");
+      break;
+    case 'e':
+      params.edgeThreshold = parsePercent(optarg, "edge threshold");
+      break;
+    case FlameGraphOption:
+      params.format = Params::Flame;
+      params.outputFile = optarg;
+      break;
+    case IcicleOption:
+      params.format = Params::Icicle;
+      params.outputFile = optarg;
+      break;
+    case ReportOption:
+      params.format = Params::TextReport;
+      break;
+    case TopOption:
+    {
+      char* end;
+      params.reportTop = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || params.reportTop == 0)
+      {
+        std::cerr << "Invalid number of rows '" << optarg << "'\n";
+        exit(EXIT_FAILURE);
+      }
+      break;
+    }
+    case SortOption:
+      if (strcmp(optarg, "self") == 0)
+        params.reportSort = Report::Self;
+      else if (strcmp(optarg, "inclusive") == 0)
+        params.reportSort = Report::Inclusive;
+      else
+      {
+        std::cerr << "Invalid sort key '" << optarg <<"'\n";
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case AnnotateOption:
+      params.format = Params::Annotate;
+      params.annotateTarget = optarg;
+      break;
+    case FootprintOption:
+      params.format = Params::FootprintReport;
+      break;
+    case CoalesceOption:
+      params.dumpInstructions = true;
+      params.coalesceInstructions = true;
+      break;
+    case IncludeOption:
+    case ExcludeOption:
+      if (!(opt == IncludeOption ? params.filter.include(optarg) : params.filter.exclude(optarg)))
+      {
+        std::cerr << "Invalid filter '" << optarg << "'\n";
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case MinCostOption:
+      params.filter.setMinCost(parsePercent(optarg, "minimal cost"));
+      break;
+    case DedupCallSitesOption:
+      params.dedupCallSites = true;
+      break;
+    case CollapseCyclesOption:
+      params.collapseCycles = true;
+      break;
+    case RecursionOption:
+      params.format = Params::RecursionReport;
+      break;
+    case FollowOption:
+    {
+      params.followInterval = defaultFollowInterval;
+      if (!optarg)
+        break;
+      char* end;
+      params.followInterval = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || params.followInterval == 0)
+      {
+        std::cerr << "Invalid follow interval '" << optarg << "'\n";
+        exit(EXIT_FAILURE);
+      }
+      break;
+    }
     default:
       printUsage();
     }
@@ -76,182 +324,873 @@ static void parseArguments(Params& params, int argc, char* argv[])
     printUsage();
   else
     params.inputFile = argv[optind];
+  if (optind + 1 < argc && !params.outputFile)
+    params.outputFile = argv[optind + 1];
 
-  // It is not possible to use callgraphs with objects only
-  if (params.details == Profile::Objects)
+  if (params.followInterval)
+  {
+    // Output is replaced as a whole every time, so readers never see it half written
+    if (!params.outputFile)
+    {
+      std::cerr << "Following input needs output file\n";
+      exit(EXIT_FAILURE);
+    }
+    // Folded objects and symbols are gone for good, later samples could not be folded the same way
+    if (!params.filter.empty() || params.collapseCycles)
+    {
+      std::cerr << "Filters and collapsed cycles can't be used while following input\n";
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Lines are known with sources only
+  if (params.format == Params::Annotate || params.format == Params::Llvm)
+    params.details = Profile::Sources;
+
+  // BOLT and footprint need exact addresses only, lines and calls would be wasted work
+  if (params.format == Params::Bolt || params.format == Params::FootprintReport)
+  {
+    params.details = Profile::Symbols;
     params.mode = Profile::Flat;
+  }
+  // Functions are ordered by calls between them, recursion is found in calls too
+  if (params.format == Params::Order || params.format == Params::RecursionReport)
+  {
+    params.details = Profile::Symbols;
+    params.mode = Profile::CallGraph;
+  }
+  if (params.format == Params::RecursionReport)
+    params.dedupCallSites = true;
 }
 
-static void dumpCallTo(std::ostream& os, const MemoryObjectData& callObjectData, const SymbolData& callSymbolData)
+/// Ids for callgrind name compression, assigned before rendering, so chunks of file could be rendered in parallel
+/** Names are identified by address, as all of them live in Profile, which is cheaper than hashing long C++ names.
+ *  Callgrind allows different ids for equal names, so it is fine if some name is stored twice. */
+class NameIds
 {
-  os << "cob=" << callObjectData.fileName()
-     << "\ncfi=" << callSymbolData.sourceFile()
-     << "\ncfn=" << callSymbolData.name() << '\n';
-}
+public:
+  struct Id
+  {
+    size_t id;
+    /// Chunk, which is the first to use this name and writes it in full
+    size_t chunk;
+  };
+
+  void add(const std::string& name, size_t chunk)
+  {
+    Id id = { ids_.size() + 1, chunk };
+    ids_.insert(IdStorage::value_type(&name, id));
+  }
+
+  const Id& get(const std::string& name) const { return ids_.find(&name)->second; }
+
+private:
+  typedef std::tr1::unordered_map<const std::string*, Id> IdStorage;
+  IdStorage ids_;
+};
+
+/// Callgrind has separate id spaces for objects (ob, cob), files (fl, fi, fe, cfi) and functions (fn, cfn)
+struct CallgrindNameIds
+{
+  NameIds objects;
+  NameIds files;
+  NameIds functions;
+};
+
+/// Callgrind name compression, first occurrence of name is written as "(id) name", next ones as "(id)"
+class NameCompressor
+{
+public:
+  NameCompressor(const NameIds& ids, size_t chunk) : ids_(ids), chunk_(chunk) {}
+
+  void write(OutputBuffer& os, const std::string& name)
+  {
+    const NameIds::Id& id = ids_.get(name);
+    os << '(' << id.id << ')';
+    if (id.chunk == chunk_ && written_.insert(&name).second)
+      os << ' ' << name;
+  }
 
-struct EntrySum
+private:
+  const NameIds& ids_;
+  size_t chunk_;
+  std::tr1::unordered_set<const std::string*> written_;
+};
+
+/// Name compression state of one chunk
+struct CallgrindNames
 {
-  EntrySum() : count(0) {}
-  std::map<const Symbol*, Count> branches;
-  Count count;
+  CallgrindNames(const CallgrindNameIds& ids, size_t chunk)
+    : objects(ids.objects, chunk)
+    , files(ids.files, chunk)
+    , functions(ids.functions, chunk)
+  {}
+
+  NameCompressor objects;
+  NameCompressor files;
+  NameCompressor functions;
 };
 
-typedef std::map<size_t, EntrySum> ByLine;
+static void dumpCallTo(OutputBuffer& os, CallgrindNames& names, const MemoryObjectData& callObjectData,
+                       const SymbolData& callSymbolData)
+{
+  os << "cob=";
+  names.objects.write(os, callObjectData.fileName());
+  os << "\ncfi=";
+  names.files.write(os, callSymbolData.sourceFile());
+  os << "\ncfn=";
+  names.functions.write(os, callSymbolData.name());
+  os << '\n';
+}
+
+/// Costs of all events, callgrind treats missing trailing costs as zero
+static void writeCosts(OutputBuffer& os, const Costs& costs)
+{
+  for (size_t event = 0; event < costs.size(); ++event)
+    os << ' ' << costs[event];
+}
 
-typedef std::map<const std::string*, ByLine> ByFileByLine;
+/// Entries without costs and calls are not written, so their names must not get ids either
+static bool isWritten(const EntryData& entryData)
+{
+  return !entryData.costs().empty() || !entryData.branches().empty();
+}
 
-struct EntryGroupper
+/// Costs of one symbol summed by source file and line
+/** Costs are kept in flat vector sorted by (file, line, called symbol), which is reused for all symbols of chunk,
+ *  so grouping of symbol with many entries is single sort instead of many map insertions. */
+class EntryGrouper
 {
-  ByFileByLine& operator()(ByFileByLine& group, const Entry& entry) const
+public:
+  struct Item
   {
-    const EntryData* entryData = entry.second;
-    EntrySum& groupData = group[&entryData->sourceFile()][entryData->sourceLine()];
-    groupData.count += entryData->count();
+    const std::string* fileName;
+    size_t line;
+    /// Own cost of line has no called symbol, so it goes before calls from this line
+    const Symbol* callSymbol;
+    Costs costs;
 
-    for (BranchStorage::const_iterator branchIt = entryData->branches().begin();
-         branchIt != entryData->branches().end(); ++branchIt)
-      groupData.branches[branchIt->first.symbol] += branchIt->second;
+    bool operator<(const Item& other) const
+    {
+      if (fileName != other.fileName)
+        return fileName < other.fileName;
+      if (line != other.line)
+        return line < other.line;
+      return callSymbol < other.callSymbol;
+    }
+  };
+  typedef std::vector<Item> ItemStorage;
 
-    return group;
+  void group(EntryStorage::const_iterator entryFirst, EntryStorage::const_iterator entryLast)
+  {
+    items_.clear();
+    for (; entryFirst != entryLast; ++entryFirst)
+    {
+      const EntryData& entryData = *entryFirst->second;
+      Item item = { &entryData.sourceFile(), entryData.sourceLine(), 0, entryData.costs() };
+      if (!item.costs.empty())
+        items_.push_back(item);
+
+      for (BranchStorage::const_iterator branchIt = entryData.branches().begin();
+           branchIt != entryData.branches().end(); ++branchIt)
+      {
+        item.callSymbol = branchIt->first.symbol;
+        item.costs = branchIt->second;
+        items_.push_back(item);
+      }
+    }
+
+    std::sort(items_.begin(), items_.end());
+
+    // Sum up equal items in place
+    ItemStorage::iterator last = items_.begin();
+    for (ItemStorage::iterator it = items_.begin(); it != items_.end(); ++it)
+    {
+      if (it == last)
+        continue;
+      if (!(*last < *it))
+        last->costs += it->costs;
+      else
+        *++last = *it;
+    }
+    if (!items_.empty())
+      items_.erase(++last, items_.end());
+  }
+
+  const ItemStorage& items() const { return items_; }
+
+private:
+  ItemStorage items_;
+};
+
+struct FileLess
+{
+  bool operator()(const EntryGrouper::Item& item, const std::string* fileName) const
+  {
+    return item.fileName < fileName;
+  }
+  bool operator()(const std::string* fileName, const EntryGrouper::Item& item) const
+  {
+    return fileName < item.fileName;
   }
 };
 
-static void dumpEntriesWithoutInstructions(std::ostream& os, const MemoryObjectStorage& objects,
+static void dumpGroupedLines(OutputBuffer& os, CallgrindNames& names, ObjectFinder& objects,
+                             EntryGrouper::ItemStorage::const_iterator itemFirst,
+                             EntryGrouper::ItemStorage::const_iterator itemLast)
+{
+  for (; itemFirst != itemLast; ++itemFirst)
+  {
+    const EntryGrouper::Item& item = *itemFirst;
+    if (!item.callSymbol)
+    {
+      os << item.line;
+      writeCosts(os, item.costs);
+      os << '\n';
+      continue;
+    }
+
+    const Symbol* callSymbol = item.callSymbol;
+    const MemoryObject& callObject = *objects.find(callSymbol->first.start);
+    dumpCallTo(os, names, *callObject.second, *callSymbol->second);
+    os << "calls=1 " << callSymbol->second->sourceLine() << '\n' << item.line;
+    writeCosts(os, item.costs);
+    os << '\n';
+  }
+}
+
+static void dumpEntriesWithoutInstructions(OutputBuffer& os, CallgrindNames& names,
+                                    ObjectFinder& objects,
+                                    EntryGrouper& grouper,
                                     const std::string* fileName,
                                     EntryStorage::const_iterator entryFirst,
                                     EntryStorage::const_iterator entryLast)
 {
-  const ByFileByLine& total = std::accumulate(entryFirst, entryLast, ByFileByLine(), EntryGroupper());
+  grouper.group(entryFirst, entryLast);
+  const EntryGrouper::ItemStorage& items = grouper.items();
 
   // We want to dump summary for current file first
-  ByFileByLine::const_iterator currFileIt = total.find(fileName);
-  ByFileByLine::const_iterator byFileByLineIt = currFileIt;
-  if (byFileByLineIt == total.end())
-    byFileByLineIt = total.begin();
-  bool currentFileDone = (currFileIt == total.end());
+  std::pair<EntryGrouper::ItemStorage::const_iterator, EntryGrouper::ItemStorage::const_iterator> currFile =
+      std::equal_range(items.begin(), items.end(), fileName, FileLess());
+  dumpGroupedLines(os, names, objects, currFile.first, currFile.second);
 
-  while (byFileByLineIt != total.end())
+  EntryGrouper::ItemStorage::const_iterator itemIt = items.begin();
+  while (itemIt != items.end())
   {
-    if (currentFileDone && byFileByLineIt == currFileIt)
+    if (itemIt == currFile.first && currFile.first != currFile.second)
     {
-      ++byFileByLineIt;
+      itemIt = currFile.second;
       continue;
     }
 
-    const std::string& fileName = *(byFileByLineIt->first);
-    const ByLine& byLine = byFileByLineIt->second;
+    const std::string* itemFileName = itemIt->fileName;
+    EntryGrouper::ItemStorage::const_iterator fileLast = itemIt;
+    while (fileLast != items.end() && fileLast->fileName == itemFileName)
+      ++fileLast;
 
-    if (currentFileDone)
-      os << "fi=" << fileName << '\n';
+    os << "fi=";
+    names.files.write(os, *itemFileName);
+    os << '\n';
+    dumpGroupedLines(os, names, objects, itemIt, fileLast);
+    itemIt = fileLast;
+  }
+}
 
-    for (ByLine::const_iterator byLineIt = byLine.begin(); byLineIt != byLine.end(); ++byLineIt)
-    {
-      size_t line = byLineIt->first;
-      const EntrySum& entrySum = byLineIt->second;
+/// Callgrind subposition compression: "*" for the same value as in previous cost line, "+N" or "-N" for near one
+/** Call targets are relative to previous cost line too, but they don't become base for next positions. Every
+ *  function starts with absolute positions, so chunks rendered separately don't depend on each other. */
+class PositionCompressor
+{
+public:
+  PositionCompressor() : haveBase_(false), address_(0), line_(0) {}
 
-      if (entrySum.count)
-        os << line << ' ' << entrySum.count << '\n';
+  void write(OutputBuffer& os, Address address, size_t line)
+  {
+    writeTarget(os, address, line);
+    haveBase_ = true;
+    address_ = address;
+    line_ = line;
+  }
 
-      for (std::map<const Symbol*, Count>::const_iterator branchIt = entrySum.branches.begin();
-           branchIt != entrySum.branches.end(); ++branchIt)
-      {
-        const Symbol* callSymbol = branchIt->first;
-        const MemoryObjectData* callObjectData = objects.at(Range(callSymbol->first.start));
-        dumpCallTo(os, *callObjectData, *callSymbol->second);
-        os << "calls=1 " << callSymbol->second->sourceLine() << '\n';
-        os << line << ' ' << branchIt->second << '\n';
-      }
-    }
-    if (!currentFileDone)
-    {
-      byFileByLineIt = total.begin();
-      currentFileDone = true;
-    }
+  void writeTarget(OutputBuffer& os, Address address, size_t line) const
+  {
+    // Relative address is shorter than hexadecimal one even for far jumps, lines win only when they are near
+    if (haveBase_ && address - address_ + 0x10000 < 0x20000)
+      writeRelative(os, int64_t(address - address_));
+    else
+      os << "0x" << Hex(address);
+    os << ' ';
+    if (haveBase_ && line - line_ + 100 < 200)
+      writeRelative(os, int64_t(line - line_));
     else
-      ++byFileByLineIt;
+      os << uint64_t(line);
+  }
+
+private:
+  static void writeRelative(OutputBuffer& os, int64_t diff)
+  {
+    if (diff == 0)
+      os << '*';
+    else if (diff > 0)
+      os << '+' << diff;
+    else
+      os << diff;
   }
-}
 
-static void dumpEntriesWithInstructions(std::ostream& os, const MemoryObjectStorage& objects,
+  bool haveBase_;
+  Address address_;
+  size_t line_;
+};
+
+static void dumpEntriesWithInstructions(OutputBuffer& os, CallgrindNames& names,
+                                 ObjectFinder& objects,
                                  const std::string* fileName,
                                  int64_t addressAdjust,
+                                 bool coalesce,
                                  EntryStorage::const_iterator entryFirst,
                                  EntryStorage::const_iterator entryLast)
 {
-  for (; entryFirst != entryLast; ++entryFirst)
+  PositionCompressor positions;
+  Costs runCosts;
+  BranchStorage runBranches;
+  while (entryFirst != entryLast)
   {
     Address entryAddress = entryFirst->first - addressAdjust;
     const EntryData& entryData = *entryFirst->second;
+    const Costs* costs = &entryData.costs();
+    const BranchStorage* branches = &entryData.branches();
+
+    EntryStorage::const_iterator runLast = entryFirst;
+    ++runLast;
+    if (coalesce)
+    {
+      // Costs of consecutive entries of the same line go to the first of them
+      EntryStorage::const_iterator entryIt = runLast;
+      while (runLast != entryLast && &runLast->second->sourceFile() == &entryData.sourceFile() &&
+             runLast->second->sourceLine() == entryData.sourceLine())
+        ++runLast;
+      if (entryIt != runLast)
+      {
+        runCosts = Costs();
+        runBranches.clear();
+        for (entryIt = entryFirst; entryIt != runLast; ++entryIt)
+        {
+          runCosts += entryIt->second->costs();
+          const BranchStorage& entryBranches = entryIt->second->branches();
+          for (BranchStorage::const_iterator branchIt = entryBranches.begin(); branchIt != entryBranches.end();
+               ++branchIt)
+            runBranches[branchIt->first] += branchIt->second;
+        }
+        costs = &runCosts;
+        branches = &runBranches;
+      }
+    }
+
+    if (costs->empty() && branches->empty())
+    {
+      entryFirst = runLast;
+      continue;
+    }
 
     if (fileName != &entryData.sourceFile())
     {
       fileName = &entryData.sourceFile();
-      os << "fi=" << *fileName << '\n';
+      os << "fi=";
+      names.files.write(os, *fileName);
+      os << '\n';
     }
 
-    if (entryData.count())
-      os << "0x" << std::hex << entryAddress << std::dec << ' ' << entryData.sourceLine() << ' '
-         << entryData.count() << '\n';
+    if (!costs->empty())
+    {
+      positions.write(os, entryAddress, entryData.sourceLine());
+      writeCosts(os, *costs);
+      os << '\n';
+    }
 
-    for (BranchStorage::const_iterator branchIt = entryFirst->second->branches().begin();
-         branchIt != entryFirst->second->branches().end(); ++branchIt)
+    for (BranchStorage::const_iterator branchIt = branches->begin(); branchIt != branches->end(); ++branchIt)
     {
       const Symbol* callSymbol = branchIt->first.symbol;
-      const MemoryObject& callObject = *objects.find(Range(callSymbol->first.start));
+      const MemoryObject& callObject = *objects.find(callSymbol->first.start);
       Address callAddress = callSymbol->first.start - callObject.first.start + callObject.second->baseAddress();
-      dumpCallTo(os, *callObject.second, *callSymbol->second);
-      os << "calls=1 0x" << std::hex << callAddress << std::dec << ' ' << callSymbol->second->sourceLine() << '\n';
-      os << "0x" << std::hex << entryAddress << std::dec << ' ' << entryData.sourceLine() << ' '
-         << branchIt->second << '\n';
+      dumpCallTo(os, names, *callObject.second, *callSymbol->second);
+      os << "calls=1 ";
+      positions.writeTarget(os, callAddress, callSymbol->second->sourceLine());
+      os << '\n';
+      positions.write(os, entryAddress, entryData.sourceLine());
+      writeCosts(os, branchIt->second);
+      os << '\n';
     }
+
+    entryFirst = runLast;
   }
 }
 
-static void dump(std::ostream& os, const Profile& profile, bool dumpInstructions)
+/// Consecutive symbols of one object, which are rendered independently of other chunks
+struct DumpChunk
 {
-  os << "positions:";
-  if (dumpInstructions)
-    os << " instr";
-  os <<" line\n";
+  const MemoryObject* object;
+  SymbolStorage::const_iterator symbolFirst;
+  SymbolStorage::const_iterator symbolLast;
+  /// Source file of previous symbol, as "fl=" is written only when file changes
+  const std::string* fileName;
+  bool objectFirst;
+  bool objectLast;
+};
 
-  os << "events: Cycles\n\n";
+/// Approximate number of entries in one chunk
+static const size_t chunkEntries = 4096;
 
-  for (MemoryObjectStorage::const_iterator objIt = profile.memoryObjects().begin();
-       objIt != profile.memoryObjects().end(); ++objIt)
+/// Splits profile into chunks and assigns name ids in the same order as chunks will use names
+static void prepareChunks(const Profile& profile, std::vector<DumpChunk>& chunks, CallgrindNameIds& ids)
+{
+  ObjectFinder finder(profile.memoryObjects());
+  const MemoryObjectStorage& objects = profile.memoryObjects();
+  for (MemoryObjectStorage::const_iterator objIt = objects.begin(); objIt != objects.end(); ++objIt)
   {
-    const MemoryObject& object = *objIt;
-    os << "ob=" << object.second->fileName() << '\n';
-
-    const EntryStorage& entries =  object.second->entries();
-    const SymbolStorage& symbols = object.second->symbols();
+    const EntryStorage& entries = objIt->second->entries();
+    const SymbolStorage& symbols = objIt->second->symbols();
 
-    const std::string* fileName = 0;
+    DumpChunk chunk;
+    chunk.object = &*objIt;
+    chunk.symbolFirst = symbols.begin();
+    chunk.fileName = 0;
+    chunk.objectFirst = true;
+    chunk.objectLast = false;
+    ids.objects.add(objIt->second->fileName(), chunks.size());
 
+    size_t entryCount = 0;
     for (SymbolStorage::const_iterator symIt = symbols.begin(); symIt != symbols.end(); ++symIt)
     {
-      const Range& symbolRange = symIt->first;
-      const SymbolData& symbolData = *symIt->second;
-
-      if (!fileName || fileName != &symbolData.sourceFile())
+      if (entryCount >= chunkEntries)
       {
-        fileName = &symbolData.sourceFile();
-        os << "fl=" << *fileName << '\n';
+        chunk.symbolLast = symIt;
+        chunks.push_back(chunk);
+        chunk.symbolFirst = symIt;
+        chunk.objectFirst = false;
+        // The last symbol before chunk was not necessarily the one setting "fl=", but it has the same file
+        chunk.fileName = &(--SymbolStorage::const_iterator(symIt))->second->sourceFile();
+        entryCount = 0;
       }
-      os << "fn=" << symbolData.name() << '\n';
 
-      EntryStorage::const_iterator entryFirst = entries.lower_bound(symbolRange.start);
-      EntryStorage::const_iterator entryLast = entries.upper_bound(symbolRange.end);
+      const SymbolData& symbolData = *symIt->second;
+      ids.files.add(symbolData.sourceFile(), chunks.size());
+      ids.functions.add(symbolData.name(), chunks.size());
 
-      if (dumpInstructions)
+      EntryStorage::const_iterator entryFirst = entries.lower_bound(symIt->first.start);
+      EntryStorage::const_iterator entryLast = entries.upper_bound(symIt->first.end);
+      for (; entryFirst != entryLast; ++entryFirst, ++entryCount)
       {
-        int64_t addresAdjust = object.first.start - object.second->baseAddress();
-        dumpEntriesWithInstructions(os, profile.memoryObjects(), fileName, addresAdjust, entryFirst, entryLast);
+        const EntryData& entryData = *entryFirst->second;
+        if (!isWritten(entryData))
+          continue;
+        ids.files.add(entryData.sourceFile(), chunks.size());
+        for (BranchStorage::const_iterator branchIt = entryData.branches().begin();
+             branchIt != entryData.branches().end(); ++branchIt)
+        {
+          const Symbol* callSymbol = branchIt->first.symbol;
+          const MemoryObject& callObject = *finder.find(callSymbol->first.start);
+          ids.objects.add(callObject.second->fileName(), chunks.size());
+          ids.files.add(callSymbol->second->sourceFile(), chunks.size());
+          ids.functions.add(callSymbol->second->name(), chunks.size());
+        }
       }
-      else
-        dumpEntriesWithoutInstructions(os, profile.memoryObjects(), fileName, entryFirst, entryLast);
     }
+
+    chunk.symbolLast = symbols.end();
+    chunk.objectLast = true;
+    chunks.push_back(chunk);
+  }
+}
+
+static void dumpChunk(OutputBuffer& os, CallgrindNames& names, const Profile& profile, const DumpChunk& chunk,
+                      bool dumpInstructions, bool coalesce)
+{
+  const MemoryObject& object = *chunk.object;
+  if (chunk.objectFirst)
+  {
+    os << "ob=";
+    names.objects.write(os, object.second->fileName());
+    os << '\n';
+  }
+
+  const EntryStorage& entries =  object.second->entries();
+
+  ObjectFinder objects(profile.memoryObjects());
+  EntryGrouper grouper;
+  const std::string* fileName = chunk.fileName;
+
+  for (SymbolStorage::const_iterator symIt = chunk.symbolFirst; symIt != chunk.symbolLast; ++symIt)
+  {
+    const Range& symbolRange = symIt->first;
+    const SymbolData& symbolData = *symIt->second;
+
+    if (!fileName || fileName != &symbolData.sourceFile())
+    {
+      fileName = &symbolData.sourceFile();
+      os << "fl=";
+      names.files.write(os, *fileName);
+      os << '\n';
+    }
+    os << "fn=";
+    names.functions.write(os, symbolData.name());
+    os << '\n';
+
+    EntryStorage::const_iterator entryFirst = entries.lower_bound(symbolRange.start);
+    EntryStorage::const_iterator entryLast = entries.upper_bound(symbolRange.end);
+
+    if (dumpInstructions)
+    {
+      int64_t addresAdjust = object.first.start - object.second->baseAddress();
+      dumpEntriesWithInstructions(os, names, objects, fileName, addresAdjust, coalesce, entryFirst, entryLast);
+    }
+    else
+      dumpEntriesWithoutInstructions(os, names, objects, grouper, fileName, entryFirst, entryLast);
+  }
+
+  if (chunk.objectLast)
     os << '\n';
+}
+
+/// Chunks are rendered by worker threads into memory and written to output in original order
+class ParallelDumper
+{
+public:
+  ParallelDumper(const Profile& profile, const std::vector<DumpChunk>& chunks, const CallgrindNameIds& ids,
+                 bool dumpInstructions, bool coalesce);
+  ~ParallelDumper();
+
+  void dump(OutputBuffer& os);
+
+private:
+  static void* worker(void* arg);
+
+  const Profile& profile_;
+  const std::vector<DumpChunk>& chunks_;
+  const CallgrindNameIds& ids_;
+  bool dumpInstructions_;
+  bool coalesce_;
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+  /// Rendered chunks, which are not written yet
+  std::vector<OutputBuffer*> rendered_;
+  size_t nextChunk_;
+  size_t writtenChunks_;
+  /// Limit for chunks kept in memory
+  size_t maxPending_;
+};
+
+ParallelDumper::ParallelDumper(const Profile& profile, const std::vector<DumpChunk>& chunks,
+                               const CallgrindNameIds& ids, bool dumpInstructions, bool coalesce)
+  : profile_(profile)
+  , chunks_(chunks)
+  , ids_(ids)
+  , dumpInstructions_(dumpInstructions)
+  , coalesce_(coalesce)
+  , rendered_(chunks.size())
+  , nextChunk_(0)
+  , writtenChunks_(0)
+  , maxPending_(0)
+{
+  pthread_mutex_init(&mutex_, 0);
+  pthread_cond_init(&cond_, 0);
+}
+
+ParallelDumper::~ParallelDumper()
+{
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+void* ParallelDumper::worker(void* arg)
+{
+  ParallelDumper* d = static_cast<ParallelDumper*>(arg);
+  while (1)
+  {
+    pthread_mutex_lock(&d->mutex_);
+    while (d->nextChunk_ < d->chunks_.size() && d->nextChunk_ >= d->writtenChunks_ + d->maxPending_)
+      pthread_cond_wait(&d->cond_, &d->mutex_);
+    if (d->nextChunk_ == d->chunks_.size())
+    {
+      pthread_mutex_unlock(&d->mutex_);
+      break;
+    }
+    size_t chunk = d->nextChunk_++;
+    pthread_mutex_unlock(&d->mutex_);
+
+    OutputBuffer* os = new OutputBuffer;
+    CallgrindNames names(d->ids_, chunk);
+    dumpChunk(*os, names, d->profile_, d->chunks_[chunk], d->dumpInstructions_, d->coalesce_);
+
+    pthread_mutex_lock(&d->mutex_);
+    d->rendered_[chunk] = os;
+    pthread_cond_broadcast(&d->cond_);
+    pthread_mutex_unlock(&d->mutex_);
   }
+  return 0;
+}
+
+void ParallelDumper::dump(OutputBuffer& os)
+{
+  long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t threadCount = std::min<size_t>(cpuCount > 0 ? cpuCount : 1, chunks_.size());
+  maxPending_ = threadCount * 4;
+
+  std::vector<pthread_t> threads;
+  if (threadCount > 1)
+  {
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+      pthread_t thread;
+      if (pthread_create(&thread, 0, &ParallelDumper::worker, this) == 0)
+        threads.push_back(thread);
+    }
+  }
+
+  // No need for threads and buffers, render everything directly into output
+  if (threads.empty())
+  {
+    for (size_t chunk = 0; chunk < chunks_.size(); ++chunk)
+    {
+      CallgrindNames names(ids_, chunk);
+      dumpChunk(os, names, profile_, chunks_[chunk], dumpInstructions_, coalesce_);
+    }
+    return;
+  }
+
+  for (size_t chunk = 0; chunk < chunks_.size(); ++chunk)
+  {
+    pthread_mutex_lock(&mutex_);
+    while (!rendered_[chunk])
+      pthread_cond_wait(&cond_, &mutex_);
+    OutputBuffer* rendered = rendered_[chunk];
+    rendered_[chunk] = 0;
+    writtenChunks_ = chunk + 1;
+    pthread_cond_broadcast(&cond_);
+    pthread_mutex_unlock(&mutex_);
+
+    os.write(rendered->data(), rendered->size());
+    delete rendered;
+  }
+
+  for (std::vector<pthread_t>::iterator it = threads.begin(); it != threads.end(); ++it)
+    pthread_join(*it, 0);
+}
+
+/// Descriptions of events known to pgcollect
+static const struct
+{
+  const char* name;
+  const char* longName;
+} eventDescriptions[] =
+{
+  { "Cycles", "CPU cycles" },
+  { "Instructions", "Instructions retired" },
+  { "CacheReferences", "Cache references" },
+  { "CacheMisses", "Cache misses" },
+  { "Branches", "Branch instructions" },
+  { "BranchMisses", "Mispredicted branches" },
+  { "RefCycles", "Reference cycles" },
+  { "CpuClock", "CPU clock, ns" },
+  { "TaskClock", "Task clock, ns" }
+};
+
+/// Events computed by KCachegrind from collected ones, formulas are linear, so there are no ratios like CPI
+static const struct
+{
+  const char* name;
+  const char* formula;
+  const char* longName;
+  const char* minuend;
+  const char* subtrahend;
+} derivedEvents[] =
+{
+  { "CacheHits", "CacheReferences - CacheMisses", "Cache hits", "CacheReferences", "CacheMisses" },
+  { "PredictedBranches", "Branches - BranchMisses", "Predicted branches", "Branches", "BranchMisses" }
+};
+
+static void writeEvents(OutputBuffer& os, const std::vector<std::string>& events)
+{
+  // Single event files keep the same header as before
+  if (events.size() > 1)
+  {
+    for (size_t i = 0; i < events.size(); ++i)
+      for (size_t j = 0; j < sizeof(eventDescriptions) / sizeof(eventDescriptions[0]); ++j)
+        if (events[i] == eventDescriptions[j].name)
+          os << "event: " << events[i] << " : " << eventDescriptions[j].longName << '\n';
+
+    for (size_t i = 0; i < sizeof(derivedEvents) / sizeof(derivedEvents[0]); ++i)
+    {
+      if (std::find(events.begin(), events.end(), derivedEvents[i].minuend) != events.end() &&
+          std::find(events.begin(), events.end(), derivedEvents[i].subtrahend) != events.end())
+        os << "event: " << derivedEvents[i].name << " = " << derivedEvents[i].formula << " : "
+           << derivedEvents[i].longName << '\n';
+    }
+  }
+
+  os << "events:";
+  for (std::vector<std::string>::const_iterator eventIt = events.begin(); eventIt != events.end(); ++eventIt)
+    os << ' ' << *eventIt;
+  os << "\n\n";
+}
+
+static void dump(OutputBuffer& os, const Profile& profile, bool dumpInstructions, bool coalesce)
+{
+  os << "positions:";
+  if (dumpInstructions)
+    os << " instr";
+  os <<" line\n";
+
+  writeEvents(os, profile.events());
+
+  std::vector<DumpChunk> chunks;
+  CallgrindNameIds ids;
+  prepareChunks(profile, chunks, ids);
+
+  ParallelDumper dumper(profile, chunks, ids, dumpInstructions, coalesce);
+  dumper.dump(os);
+}
+
+/// Writes profile in requested format into file or to standard output if fileName is 0
+static void writeOutput(const Params& params, const Profile& profile, const char* fileName)
+{
+  int fd = STDOUT_FILENO;
+  if (fileName)
+  {
+    fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+      std::cerr << "Error opening output file " << fileName << ": " << strerror(errno) << '\n';
+      exit(EXIT_FAILURE);
+    }
+  }
+  int outputFd = fd;
+
+  Compressor compressor(fd);
+  if (params.compressOutput)
+  {
+    fd = compressor.start();
+    if (fd == -1)
+    {
+      std::cerr << "Error starting compression: " << strerror(errno) << '\n';
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Compressed data goes through pipe, which can't be mapped
+  OutputBuffer output(fd, params.mmapOutput && !params.compressOutput ? OutputBuffer::Mmap : OutputBuffer::Write);
+  if (params.format == Params::Pprof)
+    PprofWriter(output, profile).write();
+  else if (params.format == Params::Folded)
+    FoldedStacks(profile).write(output);
+  else if (params.format == Params::Flame)
+    FlameGraph(FoldedStacks(profile), FlameGraph::Flame).write(output);
+  else if (params.format == Params::Icicle)
+    FlameGraph(FoldedStacks(profile), FlameGraph::Icicle).write(output);
+  else if (params.format == Params::Chrome)
+    Timeline(profile).write(output, Timeline::ChromeTrace);
+  else if (params.format == Params::Speedscope)
+    Timeline(profile).write(output, Timeline::Speedscope);
+  else if (params.format == Params::Dot)
+    DotGraph(profile, params.nodeThreshold, params.edgeThreshold).write(output);
+  else if (params.format == Params::TextReport)
+    Report(profile, params.reportTop, params.reportSort).write(output);
+  else if (params.format == Params::Llvm)
+    SampleProfile(profile).write(output);
+  else if (params.format == Params::Bolt)
+    BoltWriter(output, profile).write();
+  else if (params.format == Params::Order)
+    FunctionOrder(profile).write(output);
+  else if (params.format == Params::FootprintReport)
+    Footprint(profile).write(output);
+  else if (params.format == Params::RecursionReport)
+    Recursion(profile, params.reportTop).write(output);
+  else if (params.format == Params::Annotate)
+  {
+    Annotation annotation(profile, params.annotateTarget);
+    // Followed input could have no samples for target yet
+    if (annotation.empty() && !params.followInterval)
+    {
+      std::cerr << "No samples for '" << params.annotateTarget << "'\n";
+      exit(EXIT_FAILURE);
+    }
+    // Hot lines are colored on terminal only
+    annotation.write(output, isatty(fd));
+  }
+  else
+    dump(output, profile, params.dumpInstructions, params.coalesceInstructions);
+  bool written = output.flush();
+  if (params.compressOutput && !compressor.finish())
+    written = false;
+  if (fileName && close(outputFd) != 0)
+    written = false;
+  if (!written)
+  {
+    std::cerr << "Error writing output: " << strerror(errno) << '\n';
+    exit(EXIT_FAILURE);
+  }
+}
+
+/// Set by SIGINT and SIGTERM to stop following input, see \ref follow
+static volatile sig_atomic_t stopFollowing = 0;
+
+static void stopFollowingHandler(int)
+{
+  stopFollowing = 1;
+}
+
+/// Adds records appended to input to profile and rewrites output every few seconds until stopped by signal
+/** Only new samples are resolved, resolvers of objects are kept by profile. Output is written into temporary file,
+ *  which replaces the old one, so viewers reloading output never get it half written. */
+static void follow(const Params& params, Profile& profile, std::istream& input)
+{
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stopFollowingHandler;
+  sigaction(SIGINT, &action, 0);
+  sigaction(SIGTERM, &action, 0);
+
+  const std::string& tmpFileName = std::string(params.outputFile) + ".tmp";
+  for (;;)
+  {
+    writeOutput(params, profile, tmpFileName.c_str());
+    if (rename(tmpFileName.c_str(), params.outputFile) != 0)
+    {
+      std::cerr << "Error renaming " << tmpFileName << " to " << params.outputFile << ": " << strerror(errno) << '\n';
+      exit(EXIT_FAILURE);
+    }
+
+    // Signal interrupts sleep, records written before it are converted once more
+    size_t records = 0;
+    while (!records && !stopFollowing)
+    {
+      sleep(params.followInterval);
+      records = profile.update(input);
+    }
+    if (!records)
+      break;
+    profile.resolveAndFixup(params.details);
+  }
+}
+
+/// Symbols of every strongly connected component of call graph with two or more symbols become one symbol
+static void collapseCycles(Profile& profile)
+{
+  CallGraph graph(profile);
+  const CallGraph::NodeStorage& nodes = graph.nodes();
+  std::vector<std::vector<const Symbol*> > components;
+  for (CallGraph::NodeStorage::const_iterator nodeIt = nodes.begin(); nodeIt != nodes.end(); ++nodeIt)
+  {
+    if (components.size() <= nodeIt->cycle)
+      components.resize(nodeIt->cycle + 1);
+    components[nodeIt->cycle].push_back(nodeIt->symbol);
+  }
+
+  std::vector<std::vector<const Symbol*> > cycles;
+  for (size_t i = 0; i < components.size(); ++i)
+    if (components[i].size() > 1)
+      cycles.push_back(components[i]);
+  profile.collapseCycles(cycles);
 }
 
 int main(int argc, char** argv)
@@ -267,12 +1206,38 @@ int main(int argc, char** argv)
   }
 
   Profile profile;
+  profile.setFollow(params.followInterval != 0);
+  if (params.jitDirectory)
+    profile.setJitDirectory(params.jitDirectory);
+  // Folded stacks, flame graphs, pprof, timelines and recursion depths are built from whole stacks
+  profile.setKeepStacks(params.format == Params::Pprof || params.format == Params::Folded ||
+                        params.format == Params::Flame || params.format == Params::Icicle ||
+                        params.format == Params::Chrome || params.format == Params::Speedscope ||
+                        params.format == Params::RecursionReport);
+  profile.setDedupCallSites(params.dedupCallSites);
+  // Timelines need every sample
+  profile.setKeepSamples(params.format == Params::Chrome || params.format == Params::Speedscope);
   profile.load(input, params.mode);
-  input.close();
+  if (!params.followInterval)
+    input.close();
 
+  if (profile.samples().size() && !profile.hasSampleTimes())
+  {
+    std::cerr << "Samples have no time, timeline needs file recorded by newer pgcollect\n";
+    exit(EXIT_FAILURE);
+  }
+
+  // Filtered out objects are not resolved at all
+  params.filter.filterObjects(profile);
   profile.resolveAndFixup(params.details);
+  params.filter.filterSymbols(profile);
+  if (params.collapseCycles)
+    collapseCycles(profile);
 
-  dump(std::cout, profile, params.dumpInstructions);
+  if (params.followInterval)
+    follow(params, profile, input);
+  else
+    writeOutput(params, profile, params.outputFile);
 
   return 0;
 }
@@ -0,0 +1,60 @@
+#ifndef PGDATA_H
+#define PGDATA_H
+
+#include <linux/perf_event.h>
+
+/// Records written by pgcollect in addition to ones received from kernel
+/** Values are far above PERF_RECORD_MAX, so they will never clash with kernel ones. */
+enum pg_record_type
+{
+  /// Chunk of vDSO image of profiled process, see \ref pg_vdso_event
+  PG_RECORD_VDSO = 128,
+  /// Layout of sample events, see \ref pg_sample_format_event
+  PG_RECORD_SAMPLE_FORMAT = 129,
+  /// Event of sample id, see \ref pg_event_id_event
+  PG_RECORD_EVENT_ID = 130
+};
+
+/// Describes layout of sample events
+/** Files without this record have samples with PERF_SAMPLE_IP and PERF_SAMPLE_CALLCHAIN only. */
+struct pg_sample_format_event
+{
+  struct perf_event_header header;
+  __u64 sample_type;
+  /// Clock of sample times or -1 for perf's own clock
+  __s32 clockid;
+  __u32 reserved;
+};
+
+/// Maximum length of event name including terminating zero
+#define PG_EVENT_NAME_SIZE 32
+
+/// Maximum number of events collected at once, so event index is below it
+#define PG_MAX_EVENTS 8
+
+/// Binds sample id to event, written for every event file descriptor when several events are collected
+/** Samples of such files have PERF_SAMPLE_IDENTIFIER and PERF_SAMPLE_PERIOD. Event with index 0 is the main one,
+ *  names are short enough to be used as callgrind event names. */
+struct pg_event_id_event
+{
+  struct perf_event_header header;
+  __u64 id;
+  __u32 index;
+  __u32 reserved;
+  char name[PG_EVENT_NAME_SIZE];
+};
+
+/// vDSO image is split into chunks, as event size is limited by 16 bit header.size
+#define PG_VDSO_CHUNK_SIZE 4096
+
+/// Chunk of vDSO image, data size is header.size - offsetof(struct pg_vdso_event, data)
+/** All processes of one kernel share the same vDSO image, so there is only one image per file and it is used for
+ *  every [vdso] mapping. */
+struct pg_vdso_event
+{
+  struct perf_event_header header;
+  __u64 offset;
+  char data[PG_VDSO_CHUNK_SIZE];
+};
+
+#endif // PGDATA_H
@@ -48,6 +48,7 @@ int main(int argc, char** argv)
      << "\nbad sample events: " << profile.badSamplesCount()
      << "\ntotal sample events: " << profile.goodSamplesCount() + profile.badSamplesCount()
      << "\ntotal events: " << profile.goodSamplesCount() + profile.badSamplesCount() + profile.mmapEventCount()
+     << "\nbad records: " << profile.badRecordsCount()
      << '\n';
 
   return 0;
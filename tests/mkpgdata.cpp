@@ -0,0 +1,283 @@
+// Writes .pgdata file described by text script read from standard input, so tests don't depend on pgcollect,
+// kernel and compiler. Every line is one command, numbers could be decimal or hex with 0x prefix, or sum of them
+// like 0x401000+4:
+//
+//   format FIELD... [clock ID]           sample layout record, FIELD is ip, tid, time, identifier, period, callchain
+//   event ID INDEX NAME                  event of sample id
+//   mmap PID ADDRESS LENGTH PGOFF FILE   mapping of file
+//   sample PID TIME ID PERIOD IP [CALLER...]  sample with fields of the last layout, IP is the first stack frame
+//   vdso OFFSET SIZE                     chunk of vDSO image filled with zeros
+//   record TYPE SIZE                     record of any type with SIZE bytes of zeros after header
+//   truncate BYTES                       drop that many bytes from the end of data written so far
+//   jitdump PID                          start writing jit-PID.dump in current directory
+//   load TIME INDEX ADDRESS SIZE NAME    jitdump code load
+//   move TIME INDEX OLD NEW SIZE         jitdump code move
+//   jitrecord ID TOTALSIZE CODESIZE      jitdump code load with header sizes given as is, for broken files
+//
+// Empty lines and lines starting with '#' are skipped.
+
+#include "../pgdata.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+namespace {
+
+std::string output;
+std::ofstream jitDump;
+uint32_t jitPid = 0;
+__u64 sampleType = PERF_SAMPLE_IP | PERF_SAMPLE_CALLCHAIN;
+
+__u64 number(std::istream& is)
+{
+  std::string token;
+  is >> token;
+  char* end = const_cast<char*>(token.c_str());
+  __u64 value = 0;
+  do
+    value += strtoull(end + (*end == '+'), &end, 0);
+  while (*end == '+');
+  if (token.empty() || *end != '\0')
+  {
+    std::cerr << "Invalid number '" << token << "'\n";
+    exit(EXIT_FAILURE);
+  }
+  return value;
+}
+
+template <typename T>
+void append(std::string& data, const T& value)
+{
+  data.append((const char*)&value, sizeof(value));
+}
+
+void appendRecord(__u32 type, const std::string& payload)
+{
+  perf_event_header header;
+  header.type = type;
+  header.misc = 0;
+  header.size = sizeof(header) + payload.size();
+  append(output, header);
+  output += payload;
+}
+
+void appendJitRecord(uint32_t id, uint64_t time, const std::string& payload, uint32_t totalSize = 0)
+{
+  std::string data;
+  uint32_t header[2] = { id, totalSize ? totalSize : uint32_t(16 + payload.size()) };
+  append(data, header);
+  append(data, time);
+  data += payload;
+  jitDump.write(data.data(), data.size());
+}
+
+void startJitDump(uint32_t pid)
+{
+  jitDump.close();
+  jitPid = pid;
+  std::ostringstream fileName;
+  fileName << "jit-" << pid << ".dump";
+  jitDump.open(fileName.str().c_str(), std::ios_base::out | std::ios_base::binary);
+
+  std::string header;
+  uint32_t fields[6] = { 0x4A695444, 1, 40, 62, 0, pid };
+  append(header, fields);
+  append(header, uint64_t(0));
+  append(header, uint64_t(0));
+  jitDump.write(header.data(), header.size());
+}
+
+void format(std::istream& is)
+{
+  sampleType = 0;
+  __s32 clockId = 1;
+  std::string field;
+  while (is >> field)
+  {
+    if (field == "ip")
+      sampleType |= PERF_SAMPLE_IP;
+    else if (field == "tid")
+      sampleType |= PERF_SAMPLE_TID;
+    else if (field == "time")
+      sampleType |= PERF_SAMPLE_TIME;
+    else if (field == "identifier")
+      sampleType |= PERF_SAMPLE_IDENTIFIER;
+    else if (field == "period")
+      sampleType |= PERF_SAMPLE_PERIOD;
+    else if (field == "callchain")
+      sampleType |= PERF_SAMPLE_CALLCHAIN;
+    else if (field == "clock")
+      clockId = number(is);
+    else
+    {
+      std::cerr << "Unknown sample field '" << field << "'\n";
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  std::string payload;
+  append(payload, __u64(sampleType));
+  append(payload, clockId);
+  append(payload, __u32(0));
+  appendRecord(PG_RECORD_SAMPLE_FORMAT, payload);
+}
+
+void sample(std::istream& is)
+{
+  __u32 pid = number(is);
+  __u64 time = number(is);
+  __u64 id = number(is);
+  __u64 period = number(is);
+  std::vector<__u64> callchain(1, PERF_CONTEXT_USER);
+  while (is >> std::ws && !is.eof())
+    callchain.push_back(number(is));
+
+  // Order of fields is fixed by kernel
+  std::string payload;
+  if (sampleType & PERF_SAMPLE_IDENTIFIER)
+    append(payload, id);
+  if (sampleType & PERF_SAMPLE_IP)
+    append(payload, callchain.size() > 1 ? callchain[1] : __u64(0));
+  if (sampleType & PERF_SAMPLE_TID)
+  {
+    append(payload, pid);
+    append(payload, pid);
+  }
+  if (sampleType & PERF_SAMPLE_TIME)
+    append(payload, time);
+  if (sampleType & PERF_SAMPLE_PERIOD)
+    append(payload, period);
+  if (sampleType & PERF_SAMPLE_CALLCHAIN)
+  {
+    append(payload, __u64(callchain.size()));
+    payload.append((const char*)&callchain[0], callchain.size() * sizeof(__u64));
+  }
+  appendRecord(PERF_RECORD_SAMPLE, payload);
+}
+
+void command(const std::string& name, std::istream& is)
+{
+  std::string payload;
+  if (name == "format")
+    format(is);
+  else if (name == "event")
+  {
+    append(payload, number(is));
+    append(payload, __u32(number(is)));
+    append(payload, __u32(0));
+    std::string eventName;
+    is >> eventName;
+    eventName.resize(PG_EVENT_NAME_SIZE);
+    payload += eventName;
+    appendRecord(PG_RECORD_EVENT_ID, payload);
+  }
+  else if (name == "mmap")
+  {
+    __u32 pid = number(is);
+    append(payload, pid);
+    append(payload, pid);
+    append(payload, number(is));
+    append(payload, number(is));
+    append(payload, number(is));
+    std::string fileName;
+    is >> fileName;
+    // Kernel pads name with zeros to 8 bytes
+    fileName.resize((fileName.size() + 8) & ~size_t(7));
+    payload += fileName;
+    appendRecord(PERF_RECORD_MMAP, payload);
+  }
+  else if (name == "sample")
+    sample(is);
+  else if (name == "vdso")
+  {
+    append(payload, number(is));
+    payload.resize(payload.size() + number(is));
+    appendRecord(PG_RECORD_VDSO, payload);
+  }
+  else if (name == "record")
+  {
+    __u32 type = number(is);
+    payload.resize(number(is));
+    appendRecord(type, payload);
+  }
+  else if (name == "truncate")
+    output.resize(output.size() - std::min<size_t>(number(is), output.size()));
+  else if (name == "jitdump")
+    startJitDump(number(is));
+  else if (name == "load")
+  {
+    uint64_t time = number(is);
+    uint64_t index = number(is);
+    uint64_t address = number(is);
+    uint64_t size = number(is);
+    std::string codeName;
+    is >> codeName;
+    uint32_t ids[2] = { jitPid, jitPid };
+    append(payload, ids);
+    append(payload, address);
+    append(payload, address);
+    append(payload, size);
+    append(payload, index);
+    payload.append(codeName.c_str(), codeName.size() + 1);
+    payload.resize(payload.size() + size);
+    appendJitRecord(0, time, payload);
+  }
+  else if (name == "move")
+  {
+    uint64_t time = number(is);
+    uint64_t index = number(is);
+    uint32_t ids[2] = { jitPid, jitPid };
+    append(payload, ids);
+    uint64_t oldAddress = number(is);
+    uint64_t newAddress = number(is);
+    append(payload, newAddress);
+    append(payload, oldAddress);
+    append(payload, newAddress);
+    append(payload, number(is));
+    append(payload, index);
+    appendJitRecord(1, time, payload);
+  }
+  else if (name == "jitrecord")
+  {
+    uint32_t id = number(is);
+    uint32_t totalSize = number(is);
+    uint32_t ids[2] = { jitPid, jitPid };
+    append(payload, ids);
+    append(payload, uint64_t(0));
+    append(payload, uint64_t(0));
+    append(payload, number(is));
+    append(payload, uint64_t(0));
+    appendJitRecord(id, 0, payload, totalSize);
+  }
+  else
+  {
+    std::cerr << "Unknown command '" << name << "'\n";
+    exit(EXIT_FAILURE);
+  }
+}
+
+}
+
+int main()
+{
+  std::string line;
+  while (std::getline(std::cin, line))
+  {
+    std::istringstream is(line);
+    std::string name;
+    if (!(is >> name) || name[0] == '#')
+      continue;
+    command(name, is);
+  }
+
+  jitDump.close();
+  std::cout.write(output.data(), output.size());
+  return 0;
+}
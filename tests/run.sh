@@ -0,0 +1,194 @@
+#!/bin/sh
+# Converts .pgdata files made by mkpgdata from tests/*.pg scripts and compares results with tests/golden files.
+# Run with UPDATE=1 to rewrite golden files after intended changes of output.
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+tests=$top/tests
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work" || exit 1
+
+failed=0
+
+# In scripts '@dir' becomes this directory, '@file:line' address of the first code of line and '@name' address of
+# symbol of test program, whose debug information doesn't depend on compiler this way
+gcc -g -O0 -no-pie -o target "$tests/target.c" || exit 1
+{
+  echo "s|@dir|$work|g"
+  objdump --dwarf=decodedline target | awk '$3 ~ /^0x/ && !seen[$1 ":" $2]++ { print "s/@" $1 ":" $2 "\\b/" $3 "/g" }'
+  nm target | awk 'NF == 3 { print "s/@" $3 "\\b/0x" $1 "/g" }'
+} > addresses.sed
+
+# pgdata SCRIPT writes SCRIPT.pgdata and files of SCRIPT into this directory
+pgdata()
+{
+  sed -f addresses.sed "$tests/$1.pg" | "$tests/mkpgdata" > "$1.pgdata" || exit 1
+}
+
+# check NAME SCRIPT [hex|frames|gunzip] PROGRAM ARGS... runs PROGRAM ARGS SCRIPT.pgdata in directory with files
+# written by SCRIPT and compares its standard output with golden/NAME, 'hex' compares hex dump of binary output,
+# 'frames' compares only frames of SVG flame graph, 'gunzip' compares decompressed output. Directory is written as '@dir' and sources as '@top' in text output.
+check()
+{
+  name=$1
+  script=$2
+  shift 2
+  filter="sed -e s|$work|@dir|g -e s|$top|@top|g"
+  if [ "$1" = hex ]; then
+    filter="od -An -tx1 -v"
+    shift
+  elif [ "$1" = frames ]; then
+    filter="sed -n /^<g.fg:/p"
+    shift
+  elif [ "$1" = gunzip ]; then
+    filter="gunzip -c"
+    shift
+  fi
+  program=$1
+  shift
+
+  pgdata "$script"
+  "$top/$program" "$@" "$script.pgdata" 2> "$name.err" | $filter > "$name.out"
+  compare "$name"
+}
+
+# follow NAME SCRIPT ARGS... runs pgconvert --follow ARGS on SCRIPT.pgdata cut in the middle, which most likely
+# splits some record, appends the rest of file and compares the final output with conversion of the whole file
+follow()
+{
+  name=$1
+  script=$2
+  shift 2
+
+  pgdata "$script"
+  "$top/pgconvert" "$@" "$script.pgdata" "$name.expected" 2> "$name.err"
+  size=$(wc -c < "$script.pgdata")
+  head -c $((size / 2)) "$script.pgdata" > "$name.pgdata"
+  "$top/pgconvert" --follow=1 "$@" "$name.pgdata" "$name.out" 2>> "$name.err" &
+  pid=$!
+  # The first part is converted, before the rest is appended
+  tries=0
+  while [ ! -f "$name.out" ] && [ $tries -lt 100 ]; do
+    sleep 0.1
+    tries=$((tries + 1))
+  done
+  tail -c +$((size / 2 + 1)) "$script.pgdata" >> "$name.pgdata"
+  sleep 2
+  kill -TERM $pid
+  wait $pid
+
+  if ! diff -u "$name.expected" "$name.out"; then
+    cat "$name.err"
+    echo "FAILED: $name"
+    failed=1
+  fi
+}
+
+compare()
+{
+  if [ -n "$UPDATE" ]; then
+    cp "$1.out" "$tests/golden/$1"
+  elif ! diff -u "$tests/golden/$1" "$1.out"; then
+    cat "$1.err" 2> /dev/null
+    echo "FAILED: $1"
+    failed=1
+  fi
+}
+
+# Broken records are skipped and counted, the rest of file is still read
+check vdso vdso pginfo flat
+check format format pginfo callgraph
+check events events pginfo callgraph
+check events-callgrind events pgconvert
+
+# JIT code is kept apart for every process and follows code moves
+check jit jit pgconvert -j . -d symbol
+check jit-folded jit pgconvert -j . -d symbol -o folded
+# Samples get code active at their own time, whatever is the order of reading
+check jit-order jit-order pgconvert -j . -o folded
+
+# Callgrind name ids and relative instruction positions
+check callgrind-instructions jit pgconvert -j . -d symbol -i
+check callgrind-coalesce jit pgconvert -j . -d symbol -i --coalesce
+
+# Compressed output is the same as uncompressed one
+check jit jit gunzip pgconvert -j . -d symbol -z
+check callgrind-instructions jit gunzip pgconvert -j . -d symbol -i -z
+
+# Values weighted by periods, mappings with file offsets
+check pprof pprof hex pgconvert -d symbol -o pprof
+check pprof-folded pprof pgconvert -d symbol -o folded
+
+# Lines are counted from the first line of function, calls are separate from samples of lines
+check llvm target pgconvert -o llvm
+
+# Offsets within functions for BOLT, hot functions in call order for linker
+check bolt bolt pgconvert -o bolt
+check order bolt pgconvert -o order
+
+# Direct recursion keeps every frame of repeated return address
+check recursion-folded recursion pgconvert -j . -o folded
+check recursion-pprof recursion hex pgconvert -j . -o pprof
+
+# Filtered out objects and symbols become "[other]", calls and stack frames go through it
+check include-object filter pgconvert -j . -d symbol --include object:target
+check include-object-folded filter pgconvert -j . -o folded --include object:target
+check exclude-symbol filter pgconvert -j . -d symbol --exclude caller
+check exclude-symbol-folded filter pgconvert -j . -o folded --exclude caller
+check min-cost filter pgconvert -j . -d symbol --min-cost 25%
+check min-cost-folded filter pgconvert -j . -o folded --min-cost 25%
+
+# Runs of the same stack are coalesced, gaps split them, threads are separate tracks
+check timeline-chrome timeline pgconvert -d symbol -o chrome
+check timeline-speedscope timeline pgconvert -d symbol -o speedscope
+# Speedscope needs weight for every sample, gaps included
+sed -n 's/.*"samples":\[\(.*\)\],"weights":\[\(.*\)\]}.*/\1 \2/p' timeline-speedscope.out > weights
+while read -r samples weights; do
+  if [ "$(echo "$samples" | tr -cd '[' | wc -c)" != "$(echo "$weights" | tr ',' '\n' | wc -l)" ]; then
+    echo "FAILED: timeline-speedscope samples and weights differ in length"
+    failed=1
+  fi
+done < weights
+
+# Inclusive costs bounded within cycles, small nodes pruned into "[other]" with their calls
+check dot-recursion recursion pgconvert -j . -o dot
+check dot-jit jit pgconvert -j . -o dot -n 30
+check dot-filter filter pgconvert -j . -o dot -n 15 -e 10
+
+# Calls between objects without symbol tables, calls within one object are dropped
+check object-callgraph filter pgconvert -j . -d object
+check object-callgraph-jit jit pgconvert -j . -d object
+check object-callgraph-recursion recursion pgconvert -j . -d object
+check object-dot filter pgconvert -j . -d object -o dot
+
+# Frames of flame graphs are as wide as their samples, icicle graph is upside down
+check flamegraph filter frames pgconvert -j . -o flamegraph
+check icicle filter frames pgconvert -j . -o icicle
+
+# Source lines of function or of whole file with costs of lines and calls made from them
+check annotate-symbol target pgconvert --annotate caller
+check annotate-file target pgconvert --annotate target.c
+if ! sed -n 's/^ *\([0-9.]*% *\)*[0-9][0-9]*  //p' annotate-file.out | diff -u "$tests/target.c" -; then
+  echo "FAILED: annotate-file lines differ from source"
+  failed=1
+fi
+
+# Text reports
+check report jit pgconvert -j . --report
+check footprint jit pgconvert -j . --footprint
+check recursion recursion pgconvert -j . --recursion
+check recursion-callgrind recursion pgconvert -j . -d symbol
+check dedup-call-sites recursion pgconvert -j . -d symbol --dedup-call-sites
+
+# Cycle of even and odd becomes one symbol for calls, stacks and call graph
+check collapse-cycles recursion pgconvert -j . -d symbol --collapse-cycles
+check collapse-cycles-folded recursion pgconvert -j . -o folded --collapse-cycles
+check collapse-cycles-dot recursion pgconvert -j . -o dot --collapse-cycles
+
+# Records split between reads are read again, output is the same as for whole file
+follow follow-jit jit -j . -d symbol -o folded
+follow follow-target target -d source
+follow follow-events events
+
+[ $failed = 0 ] && echo "All tests passed"
+exit $failed
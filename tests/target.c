@@ -0,0 +1,17 @@
+/* Program for tests, only its symbols and debug information are used, it is never run. Braces are on the lines of
+   function names, so every compiler starts functions at the same lines. */
+
+int leaf(int n) {
+  return n * 2;
+}
+
+int caller(int n) {
+  int s = 0;
+  s += leaf(n);
+  s += leaf(n + 1);
+  return s;
+}
+
+int main(void) {
+  return caller(1);
+}